@@ -0,0 +1,516 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef ASYNCPROGRAMS_HPP
+#define ASYNCPROGRAMS_HPP
+
+#include <GL/glew.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef GL_COMPLETION_STATUS_ARB
+#define GL_COMPLETION_STATUS_ARB 0x91B1
+#endif
+
+// Program manager that does not stall the frame on the shader compiler.
+//
+// All shaders of a (re)load are handed to the driver without querying
+// any status, with GL_ARB/KHR_parallel_shader_compile the driver compiles
+// and links them on its own threads and GL_COMPLETION_STATUS tells when
+// they are done. Until every program of the set is linked, get() returns
+// the previous programs, then all of them are swapped at once, so the
+// frame never mixes old and new shaders. A set that fails to compile is
+// dropped and rendering continues with the old one.
+//
+// Only programs fetched with get() since the previous reload are part of
+// that set, so the permutations in use switch over as early as possible.
+// The others keep their previous program and are rebuilt in the
+// background after the swap, each one replaced on its own once linked.
+// Without the extension the status query blocks inside the driver, so
+// then only one of them is submitted per frame. At startup every program
+// is part of the set.
+//
+// "#include" of registered files is resolved here, prepends are inserted
+// after the #version line.
+
+class AsyncProgramManager {
+public:
+  typedef size_t ProgramID;
+
+  enum ReloadStatus {
+    RELOAD_NONE,      // nothing pending or still compiling
+    RELOAD_DONE,      // new programs were swapped in
+    RELOAD_FAILED,    // new programs were dropped, old ones stay active
+  };
+
+  struct Definition {
+    Definition(GLenum type, const std::string& filename)
+      : m_type(type)
+      , m_filename(filename)
+    {
+    }
+    Definition(GLenum type, const std::string& prepend, const std::string& filename)
+      : m_type(type)
+      , m_prepend(prepend)
+      , m_filename(filename)
+    {
+    }
+
+    GLenum      m_type;
+    std::string m_prepend;
+    std::string m_filename;
+  };
+
+  // prepended to all shaders, takes effect on the next reloadPrograms
+  std::string   m_prepend;
+
+  AsyncProgramManager()
+    : m_reloading(false)
+    , m_parallel(false)
+    , m_initialized(false)
+  {
+  }
+
+  ~AsyncProgramManager()
+  {
+    deletePrograms();
+  }
+
+  static std::string format(const char* msg, ...)
+  {
+    char text[8192];
+    va_list list;
+    va_start(list, msg);
+    vsnprintf(text, sizeof(text), msg, list);
+    va_end(list);
+    return std::string(text);
+  }
+
+  void addDirectory(const std::string& directory)
+  {
+    m_directories.push_back(directory);
+  }
+
+  void registerInclude(const std::string& name, const std::string& filename)
+  {
+    Include inc = {name, filename};
+    m_includes.push_back(inc);
+  }
+
+  // starts compiling right away, programs created in a row build in parallel
+  ProgramID createProgram(const Definition& def0, const Definition& def1)
+  {
+    Program prog;
+    prog.definitions.push_back(def0);
+    prog.definitions.push_back(def1);
+    return addProgram(prog);
+  }
+
+  ProgramID createProgram(const Definition& def0)
+  {
+    Program prog;
+    prog.definitions.push_back(def0);
+    return addProgram(prog);
+  }
+
+  // restarts the build of the programs used since the last reload,
+  // a build still in flight is discarded
+  void reloadPrograms()
+  {
+    for (size_t i = 0; i < m_programs.size(); i++){
+      discard(m_programs[i]);
+    }
+
+    m_reloading = false;
+    m_pendingPrepend = m_prepend;
+    for (size_t i = 0; i < m_programs.size(); i++){
+      Program& prog = m_programs[i];
+      // programs that never built must be part of the set, or we stay invalid
+      if (prog.used || !prog.active){
+        prog.building = true;
+        build(prog, m_pendingPrepend);
+        m_reloading = true;
+      }
+      prog.used = false;
+    }
+  }
+
+  // call once per frame, never waits for the compiler
+  ReloadStatus update()
+  {
+    if (!m_reloading){
+      updateStale();
+      return RELOAD_NONE;
+    }
+
+    for (size_t i = 0; i < m_programs.size(); i++){
+      if (m_programs[i].building && !isCompleted(m_programs[i])) return RELOAD_NONE;
+    }
+
+    m_reloading = false;
+
+    bool valid = true;
+    for (size_t i = 0; i < m_programs.size(); i++){
+      const Program& prog = m_programs[i];
+      if (prog.building){
+        valid = checkProgram(prog, prog.pending, prog.shaders) && valid;
+      }
+    }
+
+    if (!valid){
+      for (size_t i = 0; i < m_programs.size(); i++){
+        discard(m_programs[i]);
+      }
+      fprintf(stderr, "programs failed to build, keeping previous programs\n");
+      return RELOAD_FAILED;
+    }
+
+    for (size_t i = 0; i < m_programs.size(); i++){
+      Program& prog = m_programs[i];
+      if (prog.building){
+        if (prog.active) glDeleteProgram(prog.active);
+        prog.active   = prog.pending;
+        prog.pending  = 0;
+        prog.building = false;
+        prog.stale    = false;
+        deleteShaders(prog);
+      }
+      else {
+        // keeps running with the previous build until updateStale replaces it
+        prog.stale    = true;
+      }
+    }
+    m_activePrepend = m_pendingPrepend;
+    return RELOAD_DONE;
+  }
+
+  // blocks until the pending build is resolved, used at startup
+  bool finish()
+  {
+    while (m_reloading){
+      if (update() == RELOAD_NONE && m_reloading){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+    return areProgramsValid();
+  }
+
+  bool isReloading() const
+  {
+    return m_reloading;
+  }
+
+  bool areProgramsValid() const
+  {
+    for (size_t i = 0; i < m_programs.size(); i++){
+      if (!m_programs[i].active) return false;
+    }
+    return true;
+  }
+
+  GLuint get(ProgramID id)
+  {
+    m_programs[id].used = true;
+    return m_programs[id].active;
+  }
+
+  void deletePrograms()
+  {
+    for (size_t i = 0; i < m_programs.size(); i++){
+      discard(m_programs[i]);
+      if (m_programs[i].active) glDeleteProgram(m_programs[i].active);
+    }
+    m_programs.clear();
+    m_reloading = false;
+  }
+
+private:
+  struct Include {
+    std::string   name;
+    std::string   filename;
+  };
+
+  struct Program {
+    Program() : active(0), pending(0), failed(false), building(false), stale(false), background(false), used(false) {}
+
+    std::vector<Definition> definitions;
+    std::vector<GLuint>     shaders;
+    GLuint                  active;
+    GLuint                  pending;
+    bool                    failed;
+    bool                    building;   // part of the set the pending reload swaps in
+    bool                    stale;      // active was built for an older set
+    bool                    background; // pending replaces a stale program on its own
+    bool                    used;       // get() was called since the last reload
+  };
+
+  ProgramID addProgram(const Program& prog)
+  {
+    if (!m_reloading){
+      m_pendingPrepend = m_prepend;
+    }
+    m_programs.push_back(prog);
+
+    m_programs.back().building = true;
+    build(m_programs.back(), m_pendingPrepend);
+    m_reloading = true;
+
+    return m_programs.size() - 1;
+  }
+
+  void initParallel()
+  {
+    m_initialized = true;
+#if defined(GL_ARB_parallel_shader_compile)
+    if (glewIsSupported("GL_ARB_parallel_shader_compile")){
+      glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+      m_parallel = true;
+    }
+#endif
+#if defined(GL_KHR_parallel_shader_compile)
+    if (!m_parallel && glewIsSupported("GL_KHR_parallel_shader_compile")){
+      glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+      m_parallel = true;
+    }
+#endif
+  }
+
+  bool loadFile(const std::string& filename, std::string& content) const
+  {
+    for (size_t i = 0; i < m_directories.size(); i++){
+      std::ifstream stream((m_directories[i] + "/" + filename).c_str(), std::ios::in | std::ios::binary);
+      if (stream.is_open()){
+        std::stringstream buffer;
+        buffer << stream.rdbuf();
+        content = buffer.str();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  const Include* findInclude(const std::string& name) const
+  {
+    for (size_t i = 0; i < m_includes.size(); i++){
+      if (m_includes[i].name == name) return &m_includes[i];
+    }
+    return NULL;
+  }
+
+  bool preprocess(const std::string& filename, const std::string& global, const std::string& prepend, std::string& source) const
+  {
+    std::string content;
+    if (!loadFile(filename, content)){
+      fprintf(stderr, "shader file not found: %s\n", filename.c_str());
+      return false;
+    }
+
+    std::istringstream stream(content);
+    std::string line;
+    int         lineNumber = 0;
+    bool        versioned = false;
+
+    source.clear();
+    while (std::getline(stream, line)){
+      lineNumber++;
+
+      size_t first = line.find_first_not_of(" \t");
+      if (first != std::string::npos && line.compare(first, 8, "#include") == 0){
+        size_t begin = line.find('"', first);
+        size_t end   = begin != std::string::npos ? line.find('"', begin + 1) : std::string::npos;
+        const Include* inc = end != std::string::npos ? findInclude(line.substr(begin + 1, end - begin - 1)) : NULL;
+        std::string included;
+        if (!inc || !loadFile(inc->filename, included)){
+          fprintf(stderr, "%s(%d): cannot resolve %s\n", filename.c_str(), lineNumber, line.c_str());
+          return false;
+        }
+        source += included;
+        source += format("\n#line %d\n", lineNumber + 1);
+        continue;
+      }
+
+      source += line;
+      source += "\n";
+
+      if (!versioned && first != std::string::npos && line.compare(first, 8, "#version") == 0){
+        source += global;
+        source += prepend;
+        source += format("#line %d\n", lineNumber + 1);
+        versioned = true;
+      }
+    }
+
+    if (!versioned){
+      source = global + prepend + source;
+    }
+    return true;
+  }
+
+  // status is not queried here, that would wait for the compiler,
+  // returns 0 if a file could not be loaded
+  GLuint submit(const Program& prog, const std::string& global, std::vector<GLuint>& shaders)
+  {
+    if (!m_initialized){
+      initParallel();
+    }
+
+    GLuint program = glCreateProgram();
+
+    for (size_t i = 0; i < prog.definitions.size(); i++){
+      const Definition& def = prog.definitions[i];
+
+      std::string source;
+      if (!preprocess(def.m_filename, global, def.m_prepend, source)){
+        glDeleteProgram(program);
+        return 0;
+      }
+
+      const char* text = source.c_str();
+      GLuint shader = glCreateShader(def.m_type);
+      glShaderSource(shader, 1, &text, NULL);
+      glCompileShader(shader);
+      glAttachShader(program, shader);
+      shaders.push_back(shader);
+    }
+
+    glLinkProgram(program);
+    return program;
+  }
+
+  void build(Program& prog, const std::string& global)
+  {
+    prog.pending  = submit(prog, global, prog.shaders);
+    prog.failed   = !prog.pending;
+  }
+
+  // nothing draws with a stale program while its rebuild is in flight
+  // other than the old build itself, so each one is swapped on its own
+  void updateStale()
+  {
+    bool inFlight = false;
+    for (size_t i = 0; i < m_programs.size(); i++){
+      Program& prog = m_programs[i];
+      if (!prog.background) continue;
+      if (!isCompleted(prog)){
+        inFlight = true;
+        continue;
+      }
+
+      if (checkProgram(prog, prog.pending, prog.shaders)){
+        if (prog.active) glDeleteProgram(prog.active);
+        prog.active     = prog.pending;
+        prog.pending    = 0;
+        prog.background = false;
+        deleteShaders(prog);
+      }
+      else {
+        // keeps the previous build, the next reload tries again
+        discard(prog);
+      }
+      prog.stale = false;
+    }
+
+    for (size_t i = 0; i < m_programs.size(); i++){
+      Program& prog = m_programs[i];
+      if (!prog.stale || prog.background) continue;
+      if (!m_parallel && inFlight) break;
+
+      prog.background = true;
+      build(prog, m_activePrepend);
+      inFlight = true;
+    }
+  }
+
+  bool isCompleted(const Program& prog) const
+  {
+    if (!m_parallel || !prog.pending || prog.failed) return true;
+
+    GLint completed = GL_FALSE;
+    glGetProgramiv(prog.pending, GL_COMPLETION_STATUS_ARB, &completed);
+    return completed == GL_TRUE;
+  }
+
+  bool checkProgram(const Program& prog, GLuint program, const std::vector<GLuint>& shaders) const
+  {
+    if (!program) return false;
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked) return true;
+
+    for (size_t i = 0; i < shaders.size(); i++){
+      GLint compiled = GL_FALSE;
+      glGetShaderiv(shaders[i], GL_COMPILE_STATUS, &compiled);
+      if (!compiled){
+        char log[4096];
+        glGetShaderInfoLog(shaders[i], sizeof(log), NULL, log);
+        fprintf(stderr, "%s:\n%s\n", prog.definitions[i].m_filename.c_str(), log);
+      }
+    }
+
+    char log[4096];
+    glGetProgramInfoLog(program, sizeof(log), NULL, log);
+    fprintf(stderr, "link failed:\n%s\n", log);
+    return false;
+  }
+
+  void deleteShaders(Program& prog)
+  {
+    for (size_t i = 0; i < prog.shaders.size(); i++){
+      glDeleteShader(prog.shaders[i]);
+    }
+    prog.shaders.clear();
+  }
+
+  void discard(Program& prog)
+  {
+    if (prog.pending) glDeleteProgram(prog.pending);
+    prog.pending    = 0;
+    prog.failed     = false;
+    prog.building   = false;
+    prog.background = false;
+    deleteShaders(prog);
+  }
+
+  std::vector<std::string>  m_directories;
+  std::vector<Include>      m_includes;
+  std::vector<Program>      m_programs;
+  std::string               m_activePrepend;    // m_prepend the active programs were built with
+  std::string               m_pendingPrepend;   // m_prepend of the build in flight
+  bool                      m_reloading;
+  bool                      m_parallel;
+  bool                      m_initialized;
+};
+
+#endif
@@ -0,0 +1,178 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef CHUNKUPLOAD_HPP
+#define CHUNKUPLOAD_HPP
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "workpool.hpp"
+
+// Fills a vertex and an index buffer in fixed size chunks on a WorkPool
+// and uploads them while the remaining chunks are still generated.
+//
+// Chunk i covers the bytes [i * chunkSize, (i+1) * chunkSize) of each
+// buffer (the last one may be shorter). Workers write their chunk
+// straight into one of a ring of persistently mapped staging buffers,
+// two per pool thread, the calling thread copies finished chunks into the
+// destination buffers with glNamedCopyBufferSubDataEXT. Staging buffers
+// are reused oldest first and only once the copy out of them has passed
+// its fence, which is polled, so generation never waits on the upload
+// while other chunks are still being filled. All GL calls happen on the
+// calling thread.
+//
+// Where a chunk ends up does not depend on which worker produced it or
+// when, so as long as fill only depends on the chunk index the result is
+// independent of the number of threads.
+
+class ChunkedUpload {
+public:
+  // called on a worker, vertices and indices point to the chunk's bytes
+  typedef std::function<void(size_t chunk, unsigned char* vertices, unsigned char* indices)> FillFunc;
+
+  // vbo and ibo must hold vertexSize and indexSize bytes
+  static bool run(WorkPool& pool, GLuint vbo, GLuint ibo,
+    size_t vertexSize, size_t indexSize, size_t vertexChunkSize, size_t indexChunkSize,
+    size_t numChunks, FillFunc fill)
+  {
+    if (numChunks == 0) return true;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    size_t stagingSize = vertexChunkSize + indexChunkSize;
+
+    int numStaging = std::max(2, int(pool.getNumThreads()) * 2);
+
+    std::vector<Staging> staging(numStaging);
+    std::deque<int>      free;
+    bool mapped = true;
+    for (int i = 0; i < numStaging; i++){
+      glGenBuffers(1, &staging[i].buffer);
+      glNamedBufferStorageEXT(staging[i].buffer, stagingSize, NULL, flags);
+      staging[i].mapping = (unsigned char*)glMapNamedBufferRangeEXT(staging[i].buffer, 0, stagingSize, flags);
+      staging[i].fence   = NULL;
+      mapped = mapped && staging[i].mapping != NULL;
+      free.push_back(i);
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::deque<Done>        done;
+
+    size_t submitted = 0;
+    size_t copied    = 0;
+    while (mapped && copied < numChunks){
+      // keep the workers busy with the staging buffers the GPU is done with,
+      // only block on a copy when no chunk is being filled
+      while (submitted < numChunks && !free.empty()){
+        int idx = free.front();
+
+        Staging& slot = staging[idx];
+        if (slot.fence){
+          bool idle = submitted == copied;
+          GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, idle ? GLuint64(~0ull) : 0);
+          if (result == GL_TIMEOUT_EXPIRED) break;
+          glDeleteSync(slot.fence);
+          slot.fence = NULL;
+        }
+        free.pop_front();
+
+        size_t chunk = submitted++;
+        unsigned char* mapping = slot.mapping;
+        pool.push([=, &mutex, &cond, &done]{
+          fill(chunk, mapping, mapping + vertexChunkSize);
+
+          std::lock_guard<std::mutex> lock(mutex);
+          Done entry = {idx, chunk};
+          done.push_back(entry);
+          cond.notify_one();
+        });
+      }
+
+      std::deque<Done> finished;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]{ return !done.empty(); });
+        finished.swap(done);
+      }
+
+      for (size_t i = 0; i < finished.size(); i++){
+        Staging& slot = staging[finished[i].staging];
+        size_t chunk  = finished[i].chunk;
+
+        copyChunk(slot.buffer, 0, vbo, vertexSize, vertexChunkSize, chunk);
+        copyChunk(slot.buffer, vertexChunkSize, ibo, indexSize, indexChunkSize, chunk);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        free.push_back(finished[i].staging);
+        copied++;
+      }
+    }
+
+    // tasks still referencing the locals must be gone
+    pool.wait();
+
+    for (int i = 0; i < numStaging; i++){
+      if (staging[i].fence){
+        glClientWaitSync(staging[i].fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(~0ull));
+        glDeleteSync(staging[i].fence);
+      }
+      if (staging[i].mapping){
+        glUnmapNamedBufferEXT(staging[i].buffer);
+      }
+      glDeleteBuffers(1, &staging[i].buffer);
+    }
+
+    return mapped;
+  }
+
+private:
+  struct Staging {
+    GLuint          buffer;
+    unsigned char*  mapping;
+    GLsync          fence;
+  };
+
+  struct Done {
+    int     staging;
+    size_t  chunk;
+  };
+
+  static void copyChunk(GLuint staging, size_t stagingOffset, GLuint buffer, size_t size, size_t chunkSize, size_t chunk)
+  {
+    size_t offset = chunk * chunkSize;
+    if (offset >= size) return;
+    size_t bytes = std::min(chunkSize, size - offset);
+    glNamedCopyBufferSubDataEXT(staging, buffer, GLintptr(stagingOffset), GLintptr(offset), GLsizeiptr(bytes));
+  }
+};
+
+#endif
@@ -5,7 +5,19 @@
 
 #define UBO_SCENE     0
 
+// deinterleave grid of the cache-aware technique (AO_RANDOMTEX_SIZE^2 layers)
+// and tiling of the random texture, the sample prepends 2, 4 or 8 to all shaders
+#ifndef AO_RANDOMTEX_SIZE
 #define AO_RANDOMTEX_SIZE 4
+#endif
+#define AO_RANDOMTEX_MAXSIZE 8
+
+// kernel of the hbao shaders, the sample prepends the active one to all shaders
+#define AO_KERNEL_HBAO  0     // 8 directions x 4 steps, 32 taps
+#define AO_KERNEL_GTAO  1     // 2 slices x 2 sides x 4 steps, 16 taps, see hbao.frag.glsl
+#ifndef AO_KERNEL
+#define AO_KERNEL AO_KERNEL_HBAO
+#endif
 
 #ifdef __cplusplus
 namespace ssao
@@ -32,15 +44,16 @@ struct HBAOData {
   
   float   AOMultiplier;
   float   PowExponent;
-  vec2    _pad0;
+  float   DepthPackScale;        // view depth stored with the ao is multiplied by it
+  int     CheckerboardParity;    // checkerboard: parity of x + y of the pixels computed this frame
   
   vec4    projInfo;
   vec2    projScale;
   int     projOrtho;
-  int     _pad1;
+  float   MaxRadiusPixels;       // the radius in pixels is clamped to it
   
-  vec4    float2Offsets[AO_RANDOMTEX_SIZE*AO_RANDOMTEX_SIZE];
-  vec4    jitters[AO_RANDOMTEX_SIZE*AO_RANDOMTEX_SIZE];
+  vec4    float2Offsets[AO_RANDOMTEX_MAXSIZE*AO_RANDOMTEX_MAXSIZE];
+  vec4    jitters[AO_RANDOMTEX_MAXSIZE*AO_RANDOMTEX_MAXSIZE];
 };
 
 #ifdef __cplusplus
@@ -0,0 +1,231 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef DEPTHCAPTURE_HPP
+#define DEPTHCAPTURE_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "mappedfile.hpp"
+
+namespace ssao
+{
+  // File layout:
+  //
+  //   CaptureHeader
+  //   CaptureFrame, width * height depth values (GL_UNSIGNED_INT_24_8)
+  //   CaptureFrame, ...
+  //
+  // All frames have the same size, so frames are appended to the end
+  // and a mapped file can be indexed directly.
+
+  static const char     CAPTURE_MAGIC[8] = {'S','S','A','O','C','A','P','\0'};
+  static const uint32_t CAPTURE_VERSION = 1;
+
+  struct CaptureHeader {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  width;
+    uint32_t  height;
+    uint32_t  frameSize;  // CaptureFrame plus depth, in bytes
+    uint32_t  _pad[2];
+  };
+
+  struct CaptureFrame {
+    float     projection[16];
+    float     view[16];
+    float     nearplane;
+    float     farplane;
+    float     fov;
+    uint32_t  frameIndex;
+  };
+
+  inline uint32_t getCaptureFrameSize(uint32_t width, uint32_t height)
+  {
+    return uint32_t(sizeof(CaptureFrame) + size_t(width) * height * sizeof(uint32_t));
+  }
+
+  class CaptureWriter {
+  public:
+    CaptureWriter() : m_file(NULL), m_frames(0) {}
+    ~CaptureWriter() { close(); }
+
+    // appends to an existing capture of the same dimension, partially written
+    // frames at the end (e.g. after a crash) are overwritten
+    bool open(const char* filename, uint32_t width, uint32_t height)
+    {
+      close();
+
+      memset(&m_header, 0, sizeof(m_header));
+      memcpy(m_header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+      m_header.version    = CAPTURE_VERSION;
+      m_header.width      = width;
+      m_header.height     = height;
+      m_header.frameSize  = getCaptureFrameSize(width, height);
+
+      m_file = fopen(filename, "r+b");
+      if (m_file){
+        CaptureHeader existing;
+        if (fread(&existing, sizeof(existing), 1, m_file) == 1){
+          if (memcmp(&existing, &m_header, sizeof(CaptureHeader)) != 0){
+            close();
+            return false;
+          }
+          seek(0, SEEK_END);
+          m_frames = uint32_t((tell() - sizeof(CaptureHeader)) / m_header.frameSize);
+          seek(sizeof(CaptureHeader) + int64_t(m_frames) * m_header.frameSize, SEEK_SET);
+          return true;
+        }
+        fclose(m_file);
+      }
+
+      m_file = fopen(filename, "wb");
+      if (!m_file || fwrite(&m_header, sizeof(m_header), 1, m_file) != 1){
+        close();
+        return false;
+      }
+      m_frames = 0;
+      return true;
+    }
+
+    bool append(const CaptureFrame& frame, const void* depth)
+    {
+      if (!m_file) return false;
+
+      CaptureFrame stored = frame;
+      stored.frameIndex = m_frames;
+
+      size_t depthSize = m_header.frameSize - sizeof(CaptureFrame);
+      if (fwrite(&stored, sizeof(stored), 1, m_file) != 1 ||
+          fwrite(depth, depthSize, 1, m_file) != 1)
+      {
+        return false;
+      }
+      m_frames++;
+      return true;
+    }
+
+    void close()
+    {
+      if (m_file) fclose(m_file);
+      m_file = NULL;
+      m_frames = 0;
+    }
+
+    bool                  isOpen() const      { return m_file != NULL; }
+    uint32_t              getNumFrames() const { return m_frames; }
+    const CaptureHeader&  getHeader() const   { return m_header; }
+
+  private:
+    void seek(int64_t offset, int origin)
+    {
+#ifdef _WIN32
+      _fseeki64(m_file, offset, origin);
+#else
+      fseeko(m_file, off_t(offset), origin);
+#endif
+    }
+
+    int64_t tell()
+    {
+#ifdef _WIN32
+      return _ftelli64(m_file);
+#else
+      return int64_t(ftello(m_file));
+#endif
+    }
+
+    FILE*         m_file;
+    CaptureHeader m_header;
+    uint32_t      m_frames;
+  };
+
+  class CaptureReader {
+  public:
+    CaptureReader() : m_header(NULL), m_frames(0) {}
+
+    bool open(const char* filename)
+    {
+      close();
+      if (!m_file.open(filename) || m_file.size() < sizeof(CaptureHeader)){
+        close();
+        return false;
+      }
+
+      const CaptureHeader* header = (const CaptureHeader*)m_file.data();
+      if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0 ||
+          header->version != CAPTURE_VERSION ||
+          header->frameSize != getCaptureFrameSize(header->width, header->height))
+      {
+        close();
+        return false;
+      }
+
+      m_header = header;
+      m_frames = uint32_t((m_file.size() - sizeof(CaptureHeader)) / header->frameSize);
+      if (!m_frames){
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    void close()
+    {
+      m_file.close();
+      m_header = NULL;
+      m_frames = 0;
+    }
+
+    bool                  isOpen() const        { return m_header != NULL; }
+    uint32_t              getNumFrames() const  { return m_frames; }
+    const CaptureHeader&  getHeader() const     { return *m_header; }
+
+    const CaptureFrame* getFrame(uint32_t idx) const
+    {
+      return (const CaptureFrame*)((const char*)m_file.data() + sizeof(CaptureHeader) + size_t(idx) * m_header->frameSize);
+    }
+
+    const void* getDepth(uint32_t idx) const
+    {
+      return getFrame(idx) + 1;
+    }
+
+    // start paging in a frame ahead of its use
+    void prefetch(uint32_t idx) const
+    {
+      m_file.prefetch(sizeof(CaptureHeader) + size_t(idx) * m_header->frameSize, m_header->frameSize);
+    }
+
+  private:
+    MappedFile            m_file;
+    const CaptureHeader*  m_header;
+    uint32_t              m_frames;
+  };
+}
+
+#endif
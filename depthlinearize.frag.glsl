@@ -4,10 +4,18 @@
 #define DEPTHLINEARIZE_USEMSAA 0
 #endif
 
+// msaa: closest depth of all samples instead of a single sample
+#ifndef DEPTHLINEARIZE_CLOSEST
+#define DEPTHLINEARIZE_CLOSEST 0
+#endif
+
 layout(location=0) uniform vec4 clipInfo; // z_n * z_f,  z_n - z_f,  z_f, perspective = 1 : 0
 
+layout(location=2) uniform vec2 fetchScale; // input resolution / output resolution
+
 #if DEPTHLINEARIZE_MSAA
 layout(location=1) uniform int sampleIndex;
+layout(location=3) uniform int sampleCount;
 layout(binding=0)  uniform sampler2DMS inputTexture;
 #else
 layout(binding=0)  uniform sampler2D inputTexture;
@@ -34,10 +42,17 @@ float reconstructCSZ(float d, vec4 clipInfo) {
     }
 */
 void main() {
-#if DEPTHLINEARIZE_MSAA
-  float depth = texelFetch(inputTexture, ivec2(gl_FragCoord.xy), sampleIndex).x;
+  // point sampled when the ao runs at reduced resolution, depth must not be averaged
+  ivec2 inputPos = ivec2(gl_FragCoord.xy * fetchScale);
+#if DEPTHLINEARIZE_MSAA && DEPTHLINEARIZE_CLOSEST
+  float depth = texelFetch(inputTexture, inputPos, 0).x;
+  for (int i = 1; i < sampleCount; i++) {
+    depth = min(depth, texelFetch(inputTexture, inputPos, i).x);
+  }
+#elif DEPTHLINEARIZE_MSAA
+  float depth = texelFetch(inputTexture, inputPos, sampleIndex).x;
 #else
-  float depth = texelFetch(inputTexture, ivec2(gl_FragCoord.xy), 0).x;
+  float depth = texelFetch(inputTexture, inputPos, 0).x;
 #endif
 
   out_Color = reconstructCSZ(depth, clipInfo);
@@ -0,0 +1,303 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef FRAMESLOTS_HPP
+#define FRAMESLOTS_HPP
+
+#include <GL/glew.h>
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+// Frames in flight.
+//
+// Every frame gets one of N slots, each owning a range of a persistently
+// mapped uniform buffer, a pair of timestamp queries and a fence. The CPU
+// writes the frame's uniforms straight into the slot's range and only has
+// to wait when it comes back to a slot whose frame the GPU has not yet
+// finished, so it records frame n+1 while the GPU is still on frame n.
+// No glBufferSubData or query readback can stall in between, the timers
+// of a slot are read once its fence has passed.
+//
+// Stats (milliseconds, smoothed):
+//   cpuWait   time beginFrame blocked on the fence of the reused slot
+//   cpuFrame  time from beginFrame to endFrame, i.e. recording
+//   gpuFrame  time between the slot's first and last command on the GPU
+//   gpuIdle   time the GPU had nothing to do between two frames
+//
+// Additional timers can bracket parts of a frame, their results arrive
+// a few frames later, once the slot they were recorded in is reused.
+
+class FrameSlots {
+public:
+  static const int MAX_SLOTS = 4;
+  static const int MAX_TIMERS = 4;
+
+  struct Stats {
+    float   cpuWait;
+    float   cpuFrame;
+    float   gpuFrame;
+    float   gpuIdle;
+  };
+
+  FrameSlots()
+    : m_buffer(0)
+    , m_mapping(NULL)
+    , m_slotSize(0)
+    , m_current(0)
+    , m_numSlots(MAX_SLOTS)
+    , m_lastGpuEnd(0)
+  {
+    memset(m_slots, 0, sizeof(m_slots));
+    memset(&m_stats, 0, sizeof(m_stats));
+    memset(m_timers, 0, sizeof(m_timers));
+  }
+
+  ~FrameSlots()
+  {
+    deinit();
+  }
+
+  static size_t alignedSize(size_t size, size_t alignment)
+  {
+    return ((size + alignment - 1) / alignment) * alignment;
+  }
+
+  static size_t getUniformAlignment()
+  {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return size_t(alignment);
+  }
+
+  // slotSize must be a multiple of the uniform buffer offset alignment
+  bool init(size_t slotSize)
+  {
+    deinit();
+
+    m_slotSize = slotSize;
+    m_numSlots = MAX_SLOTS;
+
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m_buffer);
+    glNamedBufferStorageEXT(m_buffer, m_slotSize * MAX_SLOTS, NULL, flags);
+    m_mapping = glMapNamedBufferRangeEXT(m_buffer, 0, m_slotSize * MAX_SLOTS, flags);
+
+    for (int i = 0; i < MAX_SLOTS; i++){
+      glGenQueries(NUM_QUERIES, m_slots[i].queries);
+    }
+
+    return m_mapping != NULL;
+  }
+
+  void deinit()
+  {
+    if (!m_buffer) return;
+
+    for (int i = 0; i < MAX_SLOTS; i++){
+      Slot& slot = m_slots[i];
+      if (slot.fence){
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(~0ull));
+        glDeleteSync(slot.fence);
+      }
+      glDeleteQueries(NUM_QUERIES, slot.queries);
+    }
+    memset(m_slots, 0, sizeof(m_slots));
+
+    glUnmapNamedBufferEXT(m_buffer);
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    m_mapping = NULL;
+  }
+
+  // advances to the next slot, blocks only while the GPU still uses it
+  void beginFrame(int framesInFlight)
+  {
+    int numSlots = std::max(1, std::min(framesInFlight, int(MAX_SLOTS)));
+
+    Clock::time_point begin = Clock::now();
+    if (numSlots != m_numSlots){
+      // slots beyond the new count would otherwise keep their fence and
+      // report their timers whenever a later increase reaches them again
+      for (int i = numSlots; i < MAX_SLOTS; i++){
+        Slot& slot = m_slots[i];
+        if (slot.fence){
+          waitFence(slot);
+        }
+        slot.queued = false;
+        slot.timers = 0;
+      }
+      m_numSlots = numSlots;
+    }
+
+    m_current = (m_current + 1) % numSlots;
+    Slot& slot = m_slots[m_current];
+
+    if (slot.fence){
+      waitFence(slot);
+      readTimers(slot);
+    }
+    m_frameBegin = Clock::now();
+    accumulate(m_stats.cpuWait, milliseconds(begin, m_frameBegin));
+
+    glQueryCounter(slot.queries[0], GL_TIMESTAMP);
+  }
+
+  void endFrame()
+  {
+    Slot& slot = m_slots[m_current];
+    glQueryCounter(slot.queries[1], GL_TIMESTAMP);
+    slot.fence  = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.queued = true;
+
+    accumulate(m_stats.cpuFrame, milliseconds(m_frameBegin, Clock::now()));
+  }
+
+  void beginTimer(int timer)
+  {
+    glQueryCounter(m_slots[m_current].queries[2 + timer * 2], GL_TIMESTAMP);
+  }
+
+  void endTimer(int timer)
+  {
+    Slot& slot = m_slots[m_current];
+    glQueryCounter(slot.queries[2 + timer * 2 + 1], GL_TIMESTAMP);
+    slot.timers |= 1 << timer;
+  }
+
+  // returns true once per new result, time in milliseconds
+  bool getTimer(int timer, float& milliseconds)
+  {
+    if (!m_timers[timer].updated) return false;
+    m_timers[timer].updated = false;
+    milliseconds = m_timers[timer].time;
+    return true;
+  }
+
+  GLuint getBuffer() const
+  {
+    return m_buffer;
+  }
+
+  // buffer offset of a range within the current slot
+  GLintptr getOffset(size_t offsetInSlot) const
+  {
+    return GLintptr(m_slotSize * m_current + offsetInSlot);
+  }
+
+  void* getMapping(size_t offsetInSlot) const
+  {
+    return (char*)m_mapping + getOffset(offsetInSlot);
+  }
+
+  const Stats& getStats() const
+  {
+    return m_stats;
+  }
+
+private:
+  typedef std::chrono::high_resolution_clock Clock;
+
+  // frame begin/end, then begin/end per timer
+  static const int NUM_QUERIES = 2 + MAX_TIMERS * 2;
+
+  struct Slot {
+    GLuint    queries[NUM_QUERIES];
+    GLsync    fence;
+    bool      queued;
+    unsigned  timers;
+  };
+
+  struct Timer {
+    float     time;
+    bool      updated;
+  };
+
+  static float milliseconds(Clock::time_point begin, Clock::time_point end)
+  {
+    return std::chrono::duration<float, std::milli>(end - begin).count();
+  }
+
+  static void accumulate(float& value, float sample)
+  {
+    value = value * 0.9f + sample * 0.1f;
+  }
+
+  void waitFence(Slot& slot)
+  {
+    GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    while (result == GL_TIMEOUT_EXPIRED){
+      result = glClientWaitSync(slot.fence, 0, 1000000);
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = NULL;
+  }
+
+  void readTimers(Slot& slot)
+  {
+    if (!slot.queued) return;
+    slot.queued = false;
+
+    // the fence has passed, results are available without waiting
+    GLuint64 begin = 0;
+    GLuint64 end   = 0;
+    glGetQueryObjectui64v(slot.queries[0], GL_QUERY_RESULT, &begin);
+    glGetQueryObjectui64v(slot.queries[1], GL_QUERY_RESULT, &end);
+
+    accumulate(m_stats.gpuFrame, float(double(end - begin) / 1000000.0));
+    if (m_lastGpuEnd && begin > m_lastGpuEnd){
+      accumulate(m_stats.gpuIdle, float(double(begin - m_lastGpuEnd) / 1000000.0));
+    }
+    else {
+      accumulate(m_stats.gpuIdle, 0.0f);
+    }
+    m_lastGpuEnd = end;
+
+    for (int i = 0; i < MAX_TIMERS; i++){
+      if (!(slot.timers & (1 << i))) continue;
+
+      glGetQueryObjectui64v(slot.queries[2 + i * 2],     GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(slot.queries[2 + i * 2 + 1], GL_QUERY_RESULT, &end);
+      m_timers[i].time    = float(double(end - begin) / 1000000.0);
+      m_timers[i].updated = true;
+    }
+    slot.timers = 0;
+  }
+
+  GLuint            m_buffer;
+  void*             m_mapping;
+  size_t            m_slotSize;
+  int               m_current;
+  int               m_numSlots;
+  Slot              m_slots[MAX_SLOTS];
+  Stats             m_stats;
+  Timer             m_timers[MAX_TIMERS];
+  GLuint64          m_lastGpuEnd;
+  Clock::time_point m_frameBegin;
+};
+
+#endif
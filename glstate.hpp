@@ -0,0 +1,383 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef GLSTATE_HPP
+#define GLSTATE_HPP
+
+#include <GL/glew.h>
+
+#include <string.h>
+
+// Thin layer over the GL calls issued every frame.
+//
+// Remembers the bound framebuffer, program, textures, uniform buffer
+// ranges, viewport, blending, depth test and sample mask, and drops calls
+// that would not change anything. Everything going through it is counted
+// per frame:
+//
+//   calls        GL calls actually issued
+//   stateChanges issued calls that change bindings or fixed function state
+//   redundant    calls that were dropped
+//   draws        draw calls and compute dispatches
+//   uploadBytes  bytes written to buffers and textures by the CPU
+//
+// Code outside that touches the same state (e.g. the UI or resource
+// creation) must be followed by invalidate(), beginFrame() does so as well.
+
+class GLStateCache {
+public:
+  static const int MAX_TEXTURE_UNITS = 8;
+  static const int MAX_UNIFORM_BUFFERS = 4;
+
+  struct Counters {
+    unsigned int  calls;
+    unsigned int  stateChanges;
+    unsigned int  redundant;
+    unsigned int  draws;
+    unsigned int  uploadBytes;
+  };
+
+  GLStateCache()
+  {
+    memset(&m_current, 0, sizeof(m_current));
+    memset(&m_last, 0, sizeof(m_last));
+    invalidate();
+  }
+
+  // forget all state, the next call of each kind is issued again
+  void invalidate()
+  {
+    m_fbo       = INVALID;
+    m_program   = INVALID;
+    m_blendSrc  = INVALID;
+    m_blendDst  = INVALID;
+    m_sampleMask = INVALID;
+    m_blend     = UNKNOWN;
+    m_depthTest = UNKNOWN;
+    m_sampleMaskEnabled = UNKNOWN;
+    for (int i = 0; i < 4; i++){
+      m_viewport[i] = -1;
+    }
+    for (int u = 0; u < MAX_TEXTURE_UNITS; u++){
+      for (int t = 0; t < NUM_TEXTURE_TARGETS; t++){
+        m_textures[u][t] = INVALID;
+      }
+    }
+    for (int i = 0; i < MAX_UNIFORM_BUFFERS; i++){
+      m_uniformBuffers[i].buffer = INVALID;
+    }
+  }
+
+  // starts counting a new frame, the previous one is available via
+  // getCounters. Nothing is assumed about the state at this point.
+  void beginFrame()
+  {
+    m_last = m_current;
+    memset(&m_current, 0, sizeof(m_current));
+    invalidate();
+  }
+
+  const Counters& getCounters() const
+  {
+    return m_last;
+  }
+
+  void bindFramebuffer(GLuint fbo)
+  {
+    if (!change(m_fbo, fbo)) return;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  }
+
+  // framebuffer state, always issued
+  void drawBuffer(GLenum buffer)
+  {
+    countStateChange();
+    glDrawBuffer(buffer);
+  }
+
+  void useProgram(GLuint program)
+  {
+    if (!change(m_program, program)) return;
+    glUseProgram(program);
+  }
+
+  void viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+  {
+    if (m_viewport[0] == x && m_viewport[1] == y && m_viewport[2] == width && m_viewport[3] == height){
+      m_current.redundant++;
+      return;
+    }
+    m_viewport[0] = x;
+    m_viewport[1] = y;
+    m_viewport[2] = width;
+    m_viewport[3] = height;
+    countStateChange();
+    glViewport(x, y, width, height);
+  }
+
+  void enable(GLenum cap)
+  {
+    setEnabled(cap, true);
+  }
+
+  void disable(GLenum cap)
+  {
+    setEnabled(cap, false);
+  }
+
+  void blendFunc(GLenum src, GLenum dst)
+  {
+    if (m_blendSrc == src && m_blendDst == dst){
+      m_current.redundant++;
+      return;
+    }
+    m_blendSrc = src;
+    m_blendDst = dst;
+    countStateChange();
+    glBlendFunc(src, dst);
+  }
+
+  void sampleMask(GLbitfield mask)
+  {
+    if (!change(m_sampleMask, mask)) return;
+    glSampleMaski(0, mask);
+  }
+
+  void bindTexture(GLenum unit, GLenum target, GLuint texture)
+  {
+    int u = int(unit - GL_TEXTURE0);
+    int t = getTargetIndex(target);
+    if (u < MAX_TEXTURE_UNITS && t >= 0){
+      if (!change(m_textures[u][t], texture)) return;
+    }
+    else {
+      countStateChange();
+    }
+    glBindMultiTextureEXT(unit, target, texture);
+  }
+
+  // image units are not tracked
+  void bindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format)
+  {
+    countStateChange();
+    glBindImageTexture(unit, texture, level, layered, layer, access, format);
+  }
+
+  void bindUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+  {
+    if (index < GLuint(MAX_UNIFORM_BUFFERS)){
+      UniformBuffer& ubo = m_uniformBuffers[index];
+      if (ubo.buffer == buffer && ubo.offset == offset && ubo.size == size){
+        m_current.redundant++;
+        return;
+      }
+      ubo.buffer = buffer;
+      ubo.offset = offset;
+      ubo.size   = size;
+    }
+    countStateChange();
+    if (buffer){
+      glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+    }
+    else {
+      glBindBufferBase(GL_UNIFORM_BUFFER, index, 0);
+    }
+  }
+
+  void memoryBarrier(GLbitfield barriers)
+  {
+    countCall();
+    glMemoryBarrier(barriers);
+  }
+
+  void drawArrays(GLenum mode, GLint first, GLsizei count)
+  {
+    countDraw();
+    glDrawArrays(mode, first, count);
+  }
+
+  void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+  {
+    countDraw();
+    glDrawElements(mode, count, type, indices);
+  }
+
+  void dispatchCompute(GLuint x, GLuint y, GLuint z)
+  {
+    countDraw();
+    glDispatchCompute(x, y, z);
+  }
+
+  // uniforms are not tracked, only counted
+  void uniform1i(GLint location, GLint v0)
+  {
+    countCall();
+    glUniform1i(location, v0);
+  }
+
+  void uniform1f(GLint location, GLfloat v0)
+  {
+    countCall();
+    glUniform1f(location, v0);
+  }
+
+  void uniform2f(GLint location, GLfloat v0, GLfloat v1)
+  {
+    countCall();
+    glUniform2f(location, v0, v1);
+  }
+
+  void uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
+  {
+    countCall();
+    glUniform4f(location, v0, v1, v2, v3);
+  }
+
+  void uniform2fv(GLint location, const GLfloat* v)
+  {
+    countCall();
+    glUniform2fv(location, 1, v);
+  }
+
+  void uniform4fv(GLint location, const GLfloat* v)
+  {
+    countCall();
+    glUniform4fv(location, 1, v);
+  }
+
+  // other calls issued directly (attachments...) are only counted
+  void countCall(unsigned int calls = 1)
+  {
+    m_current.calls += calls;
+  }
+
+  void countUpload(size_t bytes)
+  {
+    m_current.uploadBytes += (unsigned int)bytes;
+  }
+
+private:
+  static const GLuint INVALID = ~0u;
+
+  enum Enabled {
+    DISABLED,
+    ENABLED,
+    UNKNOWN,
+  };
+
+  enum TextureTarget {
+    TARGET_2D,
+    TARGET_2D_ARRAY,
+    TARGET_2D_MULTISAMPLE,
+    NUM_TEXTURE_TARGETS,
+  };
+
+  struct UniformBuffer {
+    GLuint      buffer;
+    GLintptr    offset;
+    GLsizeiptr  size;
+  };
+
+  static int getTargetIndex(GLenum target)
+  {
+    switch (target){
+    case GL_TEXTURE_2D:             return TARGET_2D;
+    case GL_TEXTURE_2D_ARRAY:       return TARGET_2D_ARRAY;
+    case GL_TEXTURE_2D_MULTISAMPLE: return TARGET_2D_MULTISAMPLE;
+    }
+    return -1;
+  }
+
+  void countStateChange()
+  {
+    m_current.calls++;
+    m_current.stateChanges++;
+  }
+
+  void countDraw()
+  {
+    m_current.calls++;
+    m_current.draws++;
+  }
+
+  // returns true and counts if the value differs
+  bool change(GLuint& state, GLuint value)
+  {
+    if (state == value){
+      m_current.redundant++;
+      return false;
+    }
+    state = value;
+    countStateChange();
+    return true;
+  }
+
+  Enabled* getEnabled(GLenum cap)
+  {
+    switch (cap){
+    case GL_BLEND:        return &m_blend;
+    case GL_DEPTH_TEST:   return &m_depthTest;
+    case GL_SAMPLE_MASK:  return &m_sampleMaskEnabled;
+    }
+    return NULL;
+  }
+
+  void setEnabled(GLenum cap, bool enabled)
+  {
+    Enabled* state = getEnabled(cap);
+    if (state){
+      Enabled value = enabled ? ENABLED : DISABLED;
+      if (*state == value){
+        m_current.redundant++;
+        return;
+      }
+      *state = value;
+    }
+    countStateChange();
+    if (enabled){
+      glEnable(cap);
+    }
+    else {
+      glDisable(cap);
+    }
+  }
+
+  GLuint        m_fbo;
+  GLuint        m_program;
+  GLuint        m_blendSrc;
+  GLuint        m_blendDst;
+  GLuint        m_sampleMask;
+  Enabled       m_blend;
+  Enabled       m_depthTest;
+  Enabled       m_sampleMaskEnabled;
+  GLint         m_viewport[4];
+  GLuint        m_textures[MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+  UniformBuffer m_uniformBuffers[MAX_UNIFORM_BUFFERS];
+
+  Counters      m_current;
+  Counters      m_last;
+};
+
+#endif
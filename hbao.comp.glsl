@@ -0,0 +1,277 @@
+#version 430
+
+// Classic hbao (or the AO_KERNEL_GTAO slices) as compute shader. Every workgroup loads the linear depth
+// of its tile plus an APRON wide border into shared memory once, normal
+// reconstruction and all horizon taps that stay within it read from there,
+// taps further out fall back to texture fetches. Same math as
+// hbao.frag.glsl with AO_DEINTERLEAVED 0, the sample picks the apron from
+// the radius in pixels.
+
+#extension GL_ARB_shading_language_include : enable
+#include "common.h"
+
+#ifndef AO_BLUR
+#define AO_BLUR 1
+#endif
+
+#ifndef APRON
+#define APRON 8
+#endif
+
+#define TILE_SIZE     16
+#define SHARED_SIZE   (TILE_SIZE + 2 * APRON)
+
+#define M_PI 3.14159265f
+
+// tweakables
+const float  NUM_STEPS = 4;
+const float  NUM_DIRECTIONS = 8; // texRandom/g_Jitter initialization depends on this
+
+// AO_KERNEL_GTAO
+const float  NUM_SLICES = 2;      // slice rotation from the jitter depends on this
+const float  NUM_SLICE_STEPS = 4; // per side
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(std140,binding=0) uniform controlBuffer {
+  HBAOData   control;
+};
+
+layout(binding=0) uniform sampler2D texLinearDepth;
+layout(binding=1) uniform sampler2D texRandom;
+
+// format of the bound image (r8, rg16f or rg16)
+layout(binding=0) uniform writeonly image2D imgOutput;
+
+shared float s_depth[SHARED_SIZE][SHARED_SIZE];
+
+ivec2 g_SharedBase;   // pixel of s_depth[0][0]
+ivec2 g_Size;
+
+//----------------------------------------------------------------------------------
+
+float FetchDepth(ivec2 pos)
+{
+  ivec2 local = pos - g_SharedBase;
+  if (all(greaterThanEqual(local, ivec2(0))) && all(lessThan(local, ivec2(SHARED_SIZE)))) {
+    return s_depth[local.y][local.x];
+  }
+  // clamp to edge like the sampler of the fragment version
+  return texelFetch(texLinearDepth, clamp(pos, ivec2(0), g_Size - 1), 0).x;
+}
+
+vec3 UVToView(vec2 uv, float eye_z)
+{
+  return vec3((uv * control.projInfo.xy + control.projInfo.zw) * (control.projOrtho != 0 ? 1. : eye_z), eye_z);
+}
+
+vec3 FetchViewPos(ivec2 pos)
+{
+  vec2 uv = (vec2(pos) + 0.5) * control.InvFullResolution;
+  return UVToView(uv, FetchDepth(pos));
+}
+
+vec3 MinDiff(vec3 P, vec3 Pr, vec3 Pl)
+{
+  vec3 V1 = Pr - P;
+  vec3 V2 = P - Pl;
+  return (dot(V1,V1) < dot(V2,V2)) ? V1 : V2;
+}
+
+vec3 ReconstructNormal(ivec2 pos, vec3 P)
+{
+  vec3 Pr = FetchViewPos(pos + ivec2( 1, 0));
+  vec3 Pl = FetchViewPos(pos + ivec2(-1, 0));
+  vec3 Pt = FetchViewPos(pos + ivec2( 0, 1));
+  vec3 Pb = FetchViewPos(pos + ivec2( 0,-1));
+  return normalize(cross(MinDiff(P, Pr, Pl), MinDiff(P, Pt, Pb)));
+}
+
+//----------------------------------------------------------------------------------
+float Falloff(float DistanceSquare)
+{
+  return DistanceSquare * control.NegInvR2 + 1.0;
+}
+
+float ComputeAO(vec3 P, vec3 N, vec3 S)
+{
+  vec3 V = S - P;
+  float VdotV = dot(V, V);
+  float NdotV = dot(N, V) * 1.0/sqrt(VdotV);
+
+  return clamp(NdotV - control.NDotVBias,0,1) * clamp(Falloff(VdotV),0,1);
+}
+
+vec2 RotateDirection(vec2 Dir, vec2 CosSin)
+{
+  return vec2(Dir.x*CosSin.x - Dir.y*CosSin.y,
+              Dir.x*CosSin.y + Dir.y*CosSin.x);
+}
+
+//----------------------------------------------------------------------------------
+float ComputeCoarseAO(ivec2 pos, float RadiusPixels, vec4 Rand, vec3 ViewPosition, vec3 ViewNormal)
+{
+  // Divide by NUM_STEPS+1 so that the farthest samples are not fully attenuated
+  float StepSizePixels = RadiusPixels / (NUM_STEPS + 1);
+
+  const float Alpha = 2.0 * M_PI / NUM_DIRECTIONS;
+  float AO = 0;
+
+  for (float DirectionIndex = 0; DirectionIndex < NUM_DIRECTIONS; ++DirectionIndex)
+  {
+    float Angle = Alpha * DirectionIndex;
+
+    vec2 Direction = RotateDirection(vec2(cos(Angle), sin(Angle)), Rand.xy);
+
+    // Jitter starting sample within the first step
+    float RayPixels = (Rand.z * StepSizePixels + 1.0);
+
+    for (float StepIndex = 0; StepIndex < NUM_STEPS; ++StepIndex)
+    {
+      vec3 S = FetchViewPos(pos + ivec2(round(RayPixels * Direction)));
+
+      RayPixels += StepSizePixels;
+
+      AO += ComputeAO(ViewPosition, ViewNormal, S);
+    }
+  }
+
+  AO *= control.AOMultiplier / (NUM_DIRECTIONS * NUM_STEPS);
+  return clamp(1.0 - AO * 2.0,0,1);
+}
+
+#if AO_KERNEL == AO_KERNEL_GTAO
+
+//----------------------------------------------------------------------------------
+float HorizonCos(vec3 P, vec3 V, vec3 S, float LowCos)
+{
+  vec3 H = S - P;
+  float HdotH = max(dot(H, H), 1e-6);
+  return mix(LowCos, dot(H, V) * inversesqrt(HdotH), clamp(Falloff(HdotH),0,1));
+}
+
+//----------------------------------------------------------------------------------
+// same as in hbao.frag.glsl
+float ComputeSliceAO(ivec2 pos, float RadiusPixels, vec4 Rand, vec3 ViewPosition, vec3 ViewNormal)
+{
+  float StepSizePixels = RadiusPixels / (NUM_SLICE_STEPS + 1);
+
+  vec3 ViewDir = normalize(-ViewPosition);
+  vec2 CosSin  = vec2(Rand.x * Rand.x - Rand.y * Rand.y, 2.0 * Rand.x * Rand.y);
+
+  float Visibility = 0;
+
+  for (float SliceIndex = 0; SliceIndex < NUM_SLICES; ++SliceIndex)
+  {
+    float Angle = M_PI * SliceIndex / NUM_SLICES;
+
+    vec2 Direction = RotateDirection(vec2(cos(Angle), sin(Angle)), CosSin);
+
+    vec3 SliceDir   = vec3(Direction, 0);
+    vec3 OrthoDir   = SliceDir - dot(SliceDir, ViewDir) * ViewDir;
+    vec3 Axis       = normalize(cross(OrthoDir, ViewDir));
+    vec3 ProjNormal = ViewNormal - Axis * dot(ViewNormal, Axis);
+
+    float ProjNormalLength = max(length(ProjNormal), 1e-4);
+    float CosN = clamp(dot(ProjNormal, ViewDir) / ProjNormalLength, 0, 1);
+    float N    = sign(dot(OrthoDir, ProjNormal)) * acos(CosN);
+
+    float LowCos0 = cos(N + M_PI * 0.5);
+    float LowCos1 = cos(N - M_PI * 0.5);
+    float HorizonCos0 = LowCos0;
+    float HorizonCos1 = LowCos1;
+
+    for (float StepIndex = 0; StepIndex < NUM_SLICE_STEPS; ++StepIndex)
+    {
+      float RayPixels = (StepIndex + Rand.z) * StepSizePixels + 1.0;
+      ivec2 Offset    = ivec2(round(RayPixels * Direction));
+
+      HorizonCos0 = max(HorizonCos0, HorizonCos(ViewPosition, ViewDir, FetchViewPos(pos + Offset), LowCos0));
+      HorizonCos1 = max(HorizonCos1, HorizonCos(ViewPosition, ViewDir, FetchViewPos(pos - Offset), LowCos1));
+    }
+
+    float H0 = -acos(HorizonCos1);
+    float H1 =  acos(HorizonCos0);
+    H0 = N + clamp(H0 - N, -M_PI * 0.5, M_PI * 0.5);
+    H1 = N + clamp(H1 - N, -M_PI * 0.5, M_PI * 0.5);
+
+    float SinN = sin(N);
+    float Arc0 = (CosN + 2.0 * H0 * SinN - cos(2.0 * H0 - N)) * 0.25;
+    float Arc1 = (CosN + 2.0 * H1 * SinN - cos(2.0 * H1 - N)) * 0.25;
+
+    Visibility += ProjNormalLength * (Arc0 + Arc1);
+  }
+
+  float AO = 1.0 - Visibility / NUM_SLICES;
+  AO = (AO - control.NDotVBias) * control.AOMultiplier;
+  return clamp(1.0 - AO,0,1);
+}
+
+#endif
+
+//----------------------------------------------------------------------------------
+void main()
+{
+  g_Size        = textureSize(texLinearDepth, 0);
+  g_SharedBase  = ivec2(gl_WorkGroupID.xy) * TILE_SIZE - APRON;
+
+  const int numThreads = TILE_SIZE * TILE_SIZE;
+  for (int i = int(gl_LocalInvocationIndex); i < SHARED_SIZE * SHARED_SIZE; i += numThreads) {
+    ivec2 local = ivec2(i % SHARED_SIZE, i / SHARED_SIZE);
+    s_depth[local.y][local.x] = texelFetch(texLinearDepth, clamp(g_SharedBase + local, ivec2(0), g_Size - 1), 0).x;
+  }
+
+  barrier();
+
+  ivec2 pos = ivec2(gl_GlobalInvocationID.xy);
+  if (any(greaterThanEqual(pos, g_Size))) return;
+
+  vec3 ViewPosition = FetchViewPos(pos);
+
+  // Reconstruct view-space normal from nearest neighbors
+  vec3 ViewNormal = -ReconstructNormal(pos, ViewPosition);
+
+  // Compute projection of disk of radius control.R into screen space
+  float RadiusPixels = control.RadiusToScreen / (control.projOrtho != 0 ? 1.0 : ViewPosition.z);
+  RadiusPixels = min(RadiusPixels, control.MaxRadiusPixels);
+
+  // Get jitter vector for the current full-res pixel
+  vec4 Rand = texelFetch(texRandom, pos & (AO_RANDOMTEX_SIZE - 1), 0);
+
+#if AO_KERNEL == AO_KERNEL_GTAO
+  float AO = ComputeSliceAO(pos, RadiusPixels, Rand, ViewPosition, ViewNormal);
+#else
+  float AO = ComputeCoarseAO(pos, RadiusPixels, Rand, ViewPosition, ViewNormal);
+#endif
+
+#if AO_BLUR
+  imageStore(imgOutput, pos, vec4(pow(AO, control.PowExponent), ViewPosition.z * control.DepthPackScale, 0, 0));
+#else
+  imageStore(imgOutput, pos, vec4(pow(AO, control.PowExponent)));
+#endif
+}
+
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
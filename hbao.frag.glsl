@@ -28,12 +28,35 @@ https://github.com/NVIDIAGameWorks/D3DSamples/tree/master/samples/DeinterleavedT
 #define AO_LAYERED 1
 #endif
 
+// ao and depth are stored as rg16 unorm instead of rg16f,
+// depth is normalized by control.DepthPackScale
+#ifndef AO_PACKED
+#define AO_PACKED 0
+#endif
+
+// layered only: one primitive per layer of the checkerboard parity
+// control.CheckerboardParity, i.e. half of the layers
+#ifndef AO_CHECKERBOARD
+#define AO_CHECKERBOARD 0
+#endif
+
+// layered only: all msaa samples in one draw, the depth and result arrays
+// hold AO_RANDOMTEX_SIZE^2 layers per sample and the view normals one
+// layer per sample
+#ifndef AO_MSAA_LAYERED
+#define AO_MSAA_LAYERED 0
+#endif
+
 #define M_PI 3.14159265f
 
 // tweakables
 const float  NUM_STEPS = 4;
 const float  NUM_DIRECTIONS = 8; // texRandom/g_Jitter initialization depends on this
 
+// AO_KERNEL_GTAO
+const float  NUM_SLICES = 2;      // slice rotation from the jitter depends on this
+const float  NUM_SLICE_STEPS = 4; // per side
+
 layout(std140,binding=0) uniform controlBuffer {
   HBAOData   control;
 };
@@ -41,23 +64,44 @@ layout(std140,binding=0) uniform controlBuffer {
 #if AO_DEINTERLEAVED
 
 #if AO_LAYERED
-  vec2 g_Float2Offset = control.float2Offsets[gl_PrimitiveID].xy;
-  vec4 g_Jitter       = control.jitters[gl_PrimitiveID];
+#if AO_MSAA_LAYERED
+  #define AO_ELEMENTS   (AO_RANDOMTEX_SIZE * AO_RANDOMTEX_SIZE)
+  #define AO_SAMPLE     (gl_PrimitiveID / AO_ELEMENTS)
+  #define AO_ELEMENT    (gl_PrimitiveID % AO_ELEMENTS)
+  #define AO_LAYER      gl_PrimitiveID
+#elif AO_CHECKERBOARD
+  #define AO_HALF_SIZE  (AO_RANDOMTEX_SIZE / 2)
+  #define AO_LAYER_Y    (gl_PrimitiveID / AO_HALF_SIZE)
+  #define AO_LAYER      (AO_LAYER_Y * AO_RANDOMTEX_SIZE + (gl_PrimitiveID % AO_HALF_SIZE) * 2 + ((AO_LAYER_Y + control.CheckerboardParity) & 1))
+  #define AO_ELEMENT    AO_LAYER
+#else
+  #define AO_LAYER      gl_PrimitiveID
+  #define AO_ELEMENT    AO_LAYER
+#endif
+
+  vec2 g_Float2Offset = control.float2Offsets[AO_ELEMENT].xy;
+  vec4 g_Jitter       = control.jitters[AO_ELEMENT];
   
   layout(binding=0) uniform sampler2DArray texLinearDepth;
+#if AO_MSAA_LAYERED
+  layout(binding=1) uniform sampler2DArray texViewNormal;
+#else
   layout(binding=1) uniform sampler2D texViewNormal;
-#if AO_BLUR
+#endif
+#if AO_BLUR && AO_PACKED
+  layout(binding=0,rg16) uniform image2DArray imgOutput;
+#elif AO_BLUR
   layout(binding=0,rg16f) uniform image2DArray imgOutput;
 #else
   layout(binding=0,r8) uniform image2DArray imgOutput;
 #endif
 
   vec3 getQuarterCoord(vec2 UV){
-    return vec3(UV,float(gl_PrimitiveID));
+    return vec3(UV,float(AO_LAYER));
   }
   
   void outputColor(vec4 color) {
-    imageStore(imgOutput, ivec3(ivec2(gl_FragCoord.xy),gl_PrimitiveID), color);
+    imageStore(imgOutput, ivec3(ivec2(gl_FragCoord.xy),AO_LAYER), color);
   }
 #else
   layout(location=0) uniform vec2 g_Float2Offset;
@@ -176,7 +220,7 @@ vec4 GetJitter()
 float ComputeCoarseAO(vec2 FullResUV, float RadiusPixels, vec4 Rand, vec3 ViewPosition, vec3 ViewNormal)
 {
 #if AO_DEINTERLEAVED
-  RadiusPixels /= 4.0;
+  RadiusPixels /= float(AO_RANDOMTEX_SIZE);
 #endif
 
   // Divide by NUM_STEPS+1 so that the farthest samples are not fully attenuated
@@ -215,16 +259,119 @@ float ComputeCoarseAO(vec2 FullResUV, float RadiusPixels, vec4 Rand, vec3 ViewPo
   return clamp(1.0 - AO * 2.0,0,1);
 }
 
+#if AO_KERNEL == AO_KERNEL_GTAO
+
+//----------------------------------------------------------------------------------
+vec3 FetchOffsetViewPos(vec2 FullResUV, vec2 OffsetPixels)
+{
+#if AO_DEINTERLEAVED
+  return FetchQuarterResViewPos(round(OffsetPixels) * control.InvQuarterResolution + FullResUV);
+#else
+  return FetchViewPos(round(OffsetPixels) * control.InvFullResolution + FullResUV);
+#endif
+}
+
+//----------------------------------------------------------------------------------
+// cosine of the angle between the view vector and the sample, fading to
+// the tangent plane (LowCos) with the same falloff as ComputeAO
+float HorizonCos(vec3 P, vec3 V, vec3 S, float LowCos)
+{
+  vec3 H = S - P;
+  float HdotH = max(dot(H, H), 1e-6);
+  return mix(LowCos, dot(H, V) * inversesqrt(HdotH), clamp(Falloff(HdotH),0,1));
+}
+
+//----------------------------------------------------------------------------------
+// Horizon-based ao after Jimenez et al., "Practical Realtime Strategies for
+// Accurate Indirect Occlusion" (GTAO). Each slice through the pixel searches
+// the highest horizon on both sides, the visible arc in between is
+// integrated analytically against the normal projected into the slice.
+// Half the taps of ComputeCoarseAO, the per-pixel jitter and the blur take
+// care of the remaining noise.
+float ComputeSliceAO(vec2 FullResUV, float RadiusPixels, vec4 Rand, vec3 ViewPosition, vec3 ViewNormal)
+{
+#if AO_DEINTERLEAVED
+  RadiusPixels /= float(AO_RANDOMTEX_SIZE);
+#endif
+
+  float StepSizePixels = RadiusPixels / (NUM_SLICE_STEPS + 1);
+
+  vec3 ViewDir = normalize(-ViewPosition);
+
+  // the jitter rotates by up to 2 * M_PI / NUM_DIRECTIONS, the slices are
+  // M_PI / NUM_SLICES apart, twice that, so rotate by the double angle
+  vec2 CosSin = vec2(Rand.x * Rand.x - Rand.y * Rand.y, 2.0 * Rand.x * Rand.y);
+
+  float Visibility = 0;
+
+  for (float SliceIndex = 0; SliceIndex < NUM_SLICES; ++SliceIndex)
+  {
+    float Angle = M_PI * SliceIndex / NUM_SLICES;
+
+    // screen and view space x/y point the same way
+    vec2 Direction = RotateDirection(vec2(cos(Angle), sin(Angle)), CosSin);
+
+    vec3 SliceDir   = vec3(Direction, 0);
+    vec3 OrthoDir   = SliceDir - dot(SliceDir, ViewDir) * ViewDir;
+    vec3 Axis       = normalize(cross(OrthoDir, ViewDir));
+    vec3 ProjNormal = ViewNormal - Axis * dot(ViewNormal, Axis);
+
+    float ProjNormalLength = max(length(ProjNormal), 1e-4);
+    float CosN = clamp(dot(ProjNormal, ViewDir) / ProjNormalLength, 0, 1);
+    float N    = sign(dot(OrthoDir, ProjNormal)) * acos(CosN);
+
+    // horizons start at the tangent plane, 0 along +Direction, 1 along -Direction
+    float LowCos0 = cos(N + M_PI * 0.5);
+    float LowCos1 = cos(N - M_PI * 0.5);
+    float HorizonCos0 = LowCos0;
+    float HorizonCos1 = LowCos1;
+
+    for (float StepIndex = 0; StepIndex < NUM_SLICE_STEPS; ++StepIndex)
+    {
+      // Jitter starting sample within the first step
+      float RayPixels = (StepIndex + Rand.z) * StepSizePixels + 1.0;
+
+      vec3 S0 = FetchOffsetViewPos(FullResUV,  Direction * RayPixels);
+      vec3 S1 = FetchOffsetViewPos(FullResUV, -Direction * RayPixels);
+
+      HorizonCos0 = max(HorizonCos0, HorizonCos(ViewPosition, ViewDir, S0, LowCos0));
+      HorizonCos1 = max(HorizonCos1, HorizonCos(ViewPosition, ViewDir, S1, LowCos1));
+    }
+
+    float H0 = -acos(HorizonCos1);
+    float H1 =  acos(HorizonCos0);
+    H0 = N + clamp(H0 - N, -M_PI * 0.5, M_PI * 0.5);
+    H1 = N + clamp(H1 - N, -M_PI * 0.5, M_PI * 0.5);
+
+    float SinN = sin(N);
+    float Arc0 = (CosN + 2.0 * H0 * SinN - cos(2.0 * H0 - N)) * 0.25;
+    float Arc1 = (CosN + 2.0 * H1 * SinN - cos(2.0 * H1 - N)) * 0.25;
+
+    Visibility += ProjNormalLength * (Arc0 + Arc1);
+  }
+
+  // the bias drops weak occlusion, like NDotVBias does per sample for hbao
+  float AO = 1.0 - Visibility / NUM_SLICES;
+  AO = (AO - control.NDotVBias) * control.AOMultiplier;
+  return clamp(1.0 - AO,0,1);
+}
+
+#endif
+
 //----------------------------------------------------------------------------------
 void main()
 {
   
 #if AO_DEINTERLEAVED
-  vec2 base = floor(gl_FragCoord.xy) * 4.0 + g_Float2Offset;
-  vec2 uv = base * (control.InvQuarterResolution / 4.0);
+  vec2 base = floor(gl_FragCoord.xy) * float(AO_RANDOMTEX_SIZE) + g_Float2Offset;
+  vec2 uv = base * (control.InvQuarterResolution / float(AO_RANDOMTEX_SIZE));
 
   vec3 ViewPosition = FetchQuarterResViewPos(uv);
+#if AO_MSAA_LAYERED
+  vec4 NormalAndAO =  texelFetch( texViewNormal, ivec3(ivec2(base), AO_SAMPLE), 0);
+#else
   vec4 NormalAndAO =  texelFetch( texViewNormal, ivec2(base), 0);
+#endif
   vec3 ViewNormal =  -(NormalAndAO.xyz * 2.0 - 1.0);
 #else
   vec2 uv = texCoord;
@@ -236,14 +383,19 @@ void main()
 
   // Compute projection of disk of radius control.R into screen space
   float RadiusPixels = control.RadiusToScreen / (control.projOrtho != 0 ? 1.0 : ViewPosition.z);
+  RadiusPixels = min(RadiusPixels, control.MaxRadiusPixels);
 
   // Get jitter vector for the current full-res pixel
   vec4 Rand = GetJitter();
 
+#if AO_KERNEL == AO_KERNEL_GTAO
+  float AO = ComputeSliceAO(uv, RadiusPixels, Rand, ViewPosition, ViewNormal);
+#else
   float AO = ComputeCoarseAO(uv, RadiusPixels, Rand, ViewPosition, ViewNormal);
+#endif
 
 #if AO_BLUR
-  outputColor(vec4(pow(AO, control.PowExponent), ViewPosition.z, 0, 0));
+  outputColor(vec4(pow(AO, control.PowExponent), ViewPosition.z * control.DepthPackScale, 0, 0));
 #else
   outputColor(vec4(pow(AO, control.PowExponent)));
 #endif
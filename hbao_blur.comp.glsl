@@ -0,0 +1,139 @@
+#version 430
+
+// Both blur directions in one dispatch. Every workgroup loads its tile
+// plus a KERNEL_RADIUS apron of (ao, depth) into shared memory once,
+// blurs horizontally into a second shared buffer that keeps the apron
+// rows, then blurs vertically from there and writes the tile.
+// Same weights as hbao_blur.frag.glsl.
+
+#ifndef KERNEL_RADIUS
+#define KERNEL_RADIUS 3
+#endif
+
+// rg16 unorm result with normalized depth instead of rg16f
+#ifndef AO_PACKED
+#define AO_PACKED 0
+#endif
+
+// all msaa samples in one dispatch, one layer per sample (gl_WorkGroupID.z)
+#ifndef AO_MSAA_LAYERED
+#define AO_MSAA_LAYERED 0
+#endif
+
+#define TILE_SIZE   16
+#define APRON_SIZE  (TILE_SIZE + 2 * KERNEL_RADIUS)
+
+layout(local_size_x = TILE_SIZE, local_size_y = TILE_SIZE) in;
+
+layout(location=0) uniform float g_Sharpness;
+
+#if AO_MSAA_LAYERED
+layout(binding=0) uniform sampler2DArray texSource;
+#if AO_PACKED
+layout(binding=0, rg16) uniform writeonly image2DArray imgResult;
+#else
+layout(binding=0, rg16f) uniform writeonly image2DArray imgResult;
+#endif
+#define SOURCE_COORD(c)   ivec3(c, gl_WorkGroupID.z)
+#else
+layout(binding=0) uniform sampler2D texSource;
+#if AO_PACKED
+layout(binding=0, rg16) uniform writeonly image2D imgResult;
+#else
+layout(binding=0, rg16f) uniform writeonly image2D imgResult;
+#endif
+#define SOURCE_COORD(c)   (c)
+#endif
+
+shared vec2 s_input[APRON_SIZE][APRON_SIZE];        // ao, depth
+shared vec2 s_horizontal[APRON_SIZE][TILE_SIZE];    // blurred ao, center depth
+
+const float BlurSigma = float(KERNEL_RADIUS) * 0.5;
+const float BlurFalloff = 1.0 / (2.0*BlurSigma*BlurSigma);
+
+//-------------------------------------------------------------------------
+
+float BlurFunction(vec2 aoz, float r, float center_d, inout float w_total)
+{
+  float ddiff = (aoz.y - center_d) * g_Sharpness;
+  float w = exp2(-r*r*BlurFalloff - ddiff*ddiff);
+  w_total += w;
+
+  return aoz.x*w;
+}
+
+void main()
+{
+  ivec2 size      = textureSize(texSource, 0).xy;
+  ivec2 tileBase  = ivec2(gl_WorkGroupID.xy) * TILE_SIZE - KERNEL_RADIUS;
+  int   local     = int(gl_LocalInvocationIndex);
+  const int numThreads = TILE_SIZE * TILE_SIZE;
+
+  for (int i = local; i < APRON_SIZE * APRON_SIZE; i += numThreads) {
+    ivec2 pos = ivec2(i % APRON_SIZE, i / APRON_SIZE);
+    ivec2 coord = clamp(tileBase + pos, ivec2(0), size - 1);
+    s_input[pos.y][pos.x] = texelFetch(texSource, SOURCE_COORD(coord), 0).xy;
+  }
+
+  barrier();
+
+  // horizontal, including the apron rows the vertical pass needs
+  for (int i = local; i < APRON_SIZE * TILE_SIZE; i += numThreads) {
+    int row = i / TILE_SIZE;
+    int col = i % TILE_SIZE;
+
+    vec2  center  = s_input[row][col + KERNEL_RADIUS];
+    float c_total = center.x;
+    float w_total = 1.0;
+
+    for (int r = 1; r <= KERNEL_RADIUS; ++r) {
+      c_total += BlurFunction(s_input[row][col + KERNEL_RADIUS + r], float(r), center.y, w_total);
+      c_total += BlurFunction(s_input[row][col + KERNEL_RADIUS - r], float(r), center.y, w_total);
+    }
+
+    s_horizontal[row][col] = vec2(c_total/w_total, center.y);
+  }
+
+  barrier();
+
+  // vertical
+  ivec2 lpos    = ivec2(gl_LocalInvocationID.xy);
+  vec2  center  = s_horizontal[lpos.y + KERNEL_RADIUS][lpos.x];
+  float c_total = center.x;
+  float w_total = 1.0;
+
+  for (int r = 1; r <= KERNEL_RADIUS; ++r) {
+    c_total += BlurFunction(s_horizontal[lpos.y + KERNEL_RADIUS + r][lpos.x], float(r), center.y, w_total);
+    c_total += BlurFunction(s_horizontal[lpos.y + KERNEL_RADIUS - r][lpos.x], float(r), center.y, w_total);
+  }
+
+  ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+  if (all(lessThan(coord, size))) {
+    imageStore(imgResult, SOURCE_COORD(coord), vec4(c_total/w_total, center.y, 0, 0));
+  }
+}
+
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse 
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
@@ -0,0 +1,50 @@
+#version 430
+
+// shaded per msaa sample, each sample takes its layer of the array
+#ifndef AO_MSAA_LAYERED
+#define AO_MSAA_LAYERED 0
+#endif
+
+#if AO_MSAA_LAYERED
+layout(binding=0) uniform sampler2DArray texAO;
+#else
+layout(binding=0) uniform sampler2D texAO;
+#endif
+
+layout(location=0,index=0) out vec4 out_Color;
+
+// applies the ao stored in x, the scene is multiplied by blending
+
+void main()
+{
+#if AO_MSAA_LAYERED
+  out_Color = vec4(texelFetch(texAO, ivec3(ivec2(gl_FragCoord.xy), gl_SampleID), 0).x);
+#else
+  out_Color = vec4(texelFetch(texAO, ivec2(gl_FragCoord.xy), 0).x);
+#endif
+}
+
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse 
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
@@ -1,21 +1,39 @@
 #version 430
 
+#extension GL_ARB_shading_language_include : enable
+#include "common.h"
+
+// each draw writes a block of 4x2 or 2x2 layers, always 2x2 for the 2x2 grid
+#ifndef NUM_MRT
+#define NUM_MRT 8
+#endif
+#if AO_RANDOMTEX_SIZE == 2
+#undef NUM_MRT
+#define NUM_MRT 4
+#endif
+
 layout(location=0) uniform vec4      info; // xy
 vec2 uvOffset = info.xy;
 vec2 invResolution = info.zw;
 
 layout(binding=0)  uniform sampler2D texLinearDepth;
 
-layout(location=0,index=0) out float out_Color[8];
+layout(location=0,index=0) out float out_Color[NUM_MRT];
 
 //----------------------------------------------------------------------------------
 
 #if 1
 void main() {
-  vec2 uv = floor(gl_FragCoord.xy) * 4.0 + uvOffset + 0.5;
+  vec2 uv = floor(gl_FragCoord.xy) * float(AO_RANDOMTEX_SIZE) + uvOffset + 0.5;
   uv *= invResolution;  
   
   vec4 S0 = textureGather(texLinearDepth, uv, 0);
+#if NUM_MRT == 4
+  out_Color[0] = S0.w;
+  out_Color[1] = S0.z;
+  out_Color[2] = S0.x;
+  out_Color[3] = S0.y;
+#else
   vec4 S1 = textureGatherOffset(texLinearDepth, uv, ivec2(2,0), 0);
  
   out_Color[0] = S0.w;
@@ -26,10 +44,11 @@ void main() {
   out_Color[5] = S0.y;
   out_Color[6] = S1.x;
   out_Color[7] = S1.y;
+#endif
 }
 #else
 void main() {
-  vec2 uv = floor(gl_FragCoord.xy) * 4.0 + uvOffset;
+  vec2 uv = floor(gl_FragCoord.xy) * float(AO_RANDOMTEX_SIZE) + uvOffset;
   ivec2 tc = ivec2(uv);
 
   out_Color[0] = texelFetchOffset(texLinearDepth, tc, 0, ivec2(0,0)).x;
@@ -0,0 +1,80 @@
+#version 430
+
+#extension GL_ARB_shading_language_include : enable
+#include "common.h"
+
+// Linearizes and deinterleaves the depth of all msaa samples in one draw.
+// Each fullscreen triangle covers the quarter resolution grid of one
+// sample (gl_PrimitiveID). A fragment reads its AO_RANDOMTEX_SIZE^2 block
+// of that sample and stores it to the layers
+// sample * AO_RANDOMTEX_SIZE^2 + y * AO_RANDOMTEX_SIZE + x
+// of the depth array, the layout the cache-aware passes use per sample.
+
+// r16f depth array instead of r32f
+#ifndef DEPTH_HALF
+#define DEPTH_HALF 0
+#endif
+
+layout(location=0) uniform vec4 clipInfo;   // z_n * z_f,  z_n - z_f,  z_f, perspective = 1 : 0
+layout(location=1) uniform vec2 outputSize; // ao resolution
+layout(location=2) uniform vec2 fetchScale; // input resolution / ao resolution
+
+layout(binding=0)  uniform sampler2DMS inputTexture;
+#if DEPTH_HALF
+layout(binding=0,r16f) uniform writeonly image2DArray imgDepth;
+#else
+layout(binding=0,r32f) uniform writeonly image2DArray imgDepth;
+#endif
+
+float reconstructCSZ(float d, vec4 clipInfo) {
+  if (clipInfo[3] != 0) {
+    return (clipInfo[0] / (clipInfo[1] * d + clipInfo[2]));
+  }
+  else {
+    return (clipInfo[1]+clipInfo[2] - d * clipInfo[1]);
+  }
+}
+
+void main() {
+  int   sampleIdx   = gl_PrimitiveID;
+  ivec2 quarterPos  = ivec2(gl_FragCoord.xy);
+  ivec2 maxPos      = ivec2(outputSize) - 1;
+
+  for (int y = 0; y < AO_RANDOMTEX_SIZE; y++) {
+    for (int x = 0; x < AO_RANDOMTEX_SIZE; x++) {
+      // the quarter grid rounds up, pixels past the edge repeat it like
+      // the clamped gather of hbao_deinterleave.frag.glsl
+      ivec2 pos       = min(quarterPos * AO_RANDOMTEX_SIZE + ivec2(x,y), maxPos);
+      ivec2 inputPos  = ivec2((vec2(pos) + 0.5) * fetchScale);
+      float depth     = texelFetch(inputTexture, inputPos, sampleIdx).x;
+      int   layer     = (sampleIdx * AO_RANDOMTEX_SIZE + y) * AO_RANDOMTEX_SIZE + x;
+
+      imageStore(imgDepth, ivec3(quarterPos, layer), vec4(reconstructCSZ(depth, clipInfo)));
+    }
+  }
+}
+
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse 
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
\ No newline at end of file
@@ -1,25 +1,127 @@
 #version 430
 
+#extension GL_ARB_shading_language_include : enable
+#include "common.h"
+
 #ifndef AO_BLUR
 #define AO_BLUR 1
 #endif
 
+// Only the layers of parity control.CheckerboardParity were computed this
+// frame, which in full resolution is a checkerboard. The other pixels still
+// hold last frame's result. They are rebuilt from their four neighbours,
+// weighted by depth similarity, averaged with the old value clamped to the
+// range of the neighbours. The results array always stores the depth next
+// to the ao in this mode, also without AO_BLUR. There is no reprojection,
+// the old value is dropped where its stored depth no longer matches, so
+// the history only helps while the camera stands still.
+#ifndef AO_CHECKERBOARD
+#define AO_CHECKERBOARD 0
+#endif
+
+// All msaa samples at once, the array holds AO_RANDOMTEX_SIZE^2 layers per
+// sample. Without AO_BLUR the pass is shaded per sample and gl_SampleID
+// picks the layers. With AO_BLUR every fullscreen triangle handles the
+// sample gl_PrimitiveID and stores to its layer of imgOutput for the blur.
+#ifndef AO_MSAA_LAYERED
+#define AO_MSAA_LAYERED 0
+#endif
+
+// rg16 unorm output instead of rg16f, AO_MSAA_LAYERED with AO_BLUR only
+#ifndef AO_PACKED
+#define AO_PACKED 0
+#endif
+
 layout(binding=0)  uniform sampler2DArray texResultsArray;
 
+#if AO_MSAA_LAYERED && AO_BLUR
+  #define AO_SAMPLE     gl_PrimitiveID
+#if AO_PACKED
+layout(binding=0,rg16) uniform writeonly image2DArray imgOutput;
+#else
+layout(binding=0,rg16f) uniform writeonly image2DArray imgOutput;
+#endif
+#elif AO_MSAA_LAYERED
+  #define AO_SAMPLE     gl_SampleID
+#else
+  #define AO_SAMPLE     0
+#endif
+
+#if AO_CHECKERBOARD
+layout(std140,binding=0) uniform controlBuffer {
+  HBAOData   control;
+};
+
+layout(binding=1)  uniform sampler2D texLinearDepth;
+
+// relative depth difference at which a neighbour's weight halves
+const float CHECKER_DEPTH_FALLOFF = 0.02;
+#endif
+
+#if !(AO_MSAA_LAYERED && AO_BLUR)
 layout(location=0,index=0) out vec4 out_Color;
+#endif
 
 //----------------------------------------------------------------------------------
 
+vec2 FetchResult(ivec2 FullResPos) {
+  ivec2 Offset = FullResPos & (AO_RANDOMTEX_SIZE - 1);
+  int SliceId = (AO_SAMPLE * AO_RANDOMTEX_SIZE + Offset.y) * AO_RANDOMTEX_SIZE + Offset.x;
+  ivec2 QuarterResPos = FullResPos / AO_RANDOMTEX_SIZE;
+  return texelFetch( texResultsArray, ivec3(QuarterResPos, SliceId), 0).xy;
+}
+
+#if AO_CHECKERBOARD
+vec2 ReconstructResult(ivec2 FullResPos, vec2 History) {
+  ivec2 Size  = textureSize(texLinearDepth, 0);
+  float Depth = texelFetch(texLinearDepth, FullResPos, 0).x;
+
+  const ivec2 Offsets[4] = ivec2[](ivec2(1,0), ivec2(-1,0), ivec2(0,1), ivec2(0,-1));
+
+  float AOSum = 0;
+  float WeightSum = 0;
+  float AOMin = 1;
+  float AOMax = 0;
+  for (int i = 0; i < 4; i++) {
+    ivec2 Pos = clamp(FullResPos + Offsets[i], ivec2(0), Size - 1);
+    float AO  = FetchResult(Pos).x;
+    float Diff = abs(texelFetch(texLinearDepth, Pos, 0).x - Depth) / (Depth * CHECKER_DEPTH_FALLOFF);
+    float Weight = exp2(-Diff * Diff) + 1e-4;
+
+    AOSum += AO * Weight;
+    WeightSum += Weight;
+    AOMin = min(AOMin, AO);
+    AOMax = max(AOMax, AO);
+  }
+  float AO = AOSum / WeightSum;
+
+  float HistoryWeight = 0.5;
+  float HistoryDepth = History.y / control.DepthPackScale;
+  if (abs(HistoryDepth - Depth) > Depth * CHECKER_DEPTH_FALLOFF) {
+    HistoryWeight = 0;
+  }
+  AO = mix(AO, clamp(History.x, AOMin, AOMax), HistoryWeight);
+
+  return vec2(AO, Depth * control.DepthPackScale);
+}
+#endif
+
 void main() {
   ivec2 FullResPos = ivec2(gl_FragCoord.xy);
-  ivec2 Offset = FullResPos & 3;
-  int SliceId = Offset.y * 4 + Offset.x;
-  ivec2 QuarterResPos = FullResPos >> 2;
+  vec2 Result = FetchResult(FullResPos);
+
+#if AO_CHECKERBOARD
+  if (((FullResPos.x + FullResPos.y) & 1) != control.CheckerboardParity) {
+    Result = ReconstructResult(FullResPos, Result);
+  }
+#endif
   
-#if AO_BLUR
-  out_Color = vec4(texelFetch( texResultsArray, ivec3(QuarterResPos, SliceId), 0).xy,0,0);
+#if AO_MSAA_LAYERED && AO_BLUR
+  imageStore(imgOutput, ivec3(FullResPos, AO_SAMPLE), vec4(Result,0,0));
+#elif AO_BLUR
+  out_Color = vec4(Result,0,0);
 #else
-  out_Color = vec4(texelFetch( texResultsArray, ivec3(QuarterResPos, SliceId), 0).x);
+  out_Color = vec4(Result.x);
 #endif
   
 }
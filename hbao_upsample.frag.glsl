@@ -0,0 +1,89 @@
+#version 430
+
+#ifndef UPSAMPLE_MSAA
+#define UPSAMPLE_MSAA 0
+#endif
+
+layout(location=0) uniform vec4 clipInfo; // z_n * z_f,  z_n - z_f,  z_f, perspective = 1 : 0
+layout(location=1) uniform int  sampleIndex;
+layout(location=2) uniform vec2 aoScale;  // ao resolution / full resolution
+
+layout(binding=0)  uniform sampler2D texAO;
+layout(binding=1)  uniform sampler2D texLinearDepth; // at ao resolution
+#if UPSAMPLE_MSAA
+layout(binding=2)  uniform sampler2DMS texDepth;
+#else
+layout(binding=2)  uniform sampler2D texDepth;
+#endif
+
+layout(location=0,index=0) out vec4 out_Color;
+
+float reconstructCSZ(float d, vec4 clipInfo) {
+  if (clipInfo[3] != 0) {
+    return (clipInfo[0] / (clipInfo[1] * d + clipInfo[2]));
+  }
+  else {
+    return (clipInfo[1]+clipInfo[2] - d * clipInfo[1]);
+  }
+}
+
+//----------------------------------------------------------------------------------
+
+// bilinear weights of the four nearest ao texels, reduced for texels
+// whose depth differs from the full resolution pixel, so ao does not
+// bleed over silhouettes
+
+void main() {
+#if UPSAMPLE_MSAA
+  float depth = texelFetch(texDepth, ivec2(gl_FragCoord.xy), sampleIndex).x;
+#else
+  float depth = texelFetch(texDepth, ivec2(gl_FragCoord.xy), 0).x;
+#endif
+  float viewDepth = reconstructCSZ(depth, clipInfo);
+
+  vec2  aoPos   = gl_FragCoord.xy * aoScale - 0.5;
+  ivec2 basePos = ivec2(floor(aoPos));
+  vec2  frac    = aoPos - vec2(basePos);
+  ivec2 maxPos  = textureSize(texAO, 0) - 1;
+
+  float aoTotal = 0;
+  float wTotal  = 0;
+  for (int i = 0; i < 4; i++) {
+    ivec2 offset = ivec2(i & 1, i >> 1);
+    ivec2 pos = clamp(basePos + offset, ivec2(0), maxPos);
+
+    float w = (offset.x != 0 ? frac.x : 1.0 - frac.x) * (offset.y != 0 ? frac.y : 1.0 - frac.y);
+    float d = texelFetch(texLinearDepth, pos, 0).x;
+    w /= abs(d - viewDepth) / viewDepth + 0.001;
+
+    aoTotal += texelFetch(texAO, pos, 0).x * w;
+    wTotal  += w;
+  }
+
+  out_Color = vec4(aoTotal / max(wTotal, 1e-6));
+}
+
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse 
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
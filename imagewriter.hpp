@@ -0,0 +1,118 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef IMAGEWRITER_HPP
+#define IMAGEWRITER_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+namespace ssao
+{
+  // Binary PPM (P6) that is filled in rectangles, in any order. Every row
+  // of a rectangle is written at its final offset, so memory use does not
+  // depend on the image size and files larger than 4 GB work as well.
+
+  class TiledImageWriter {
+  public:
+    TiledImageWriter() : m_file(NULL), m_width(0), m_height(0), m_headerSize(0) {}
+    ~TiledImageWriter() { close(); }
+
+    bool open(const char* filename, int width, int height)
+    {
+      close();
+      m_file = fopen(filename, "wb");
+      if (!m_file) return false;
+
+      m_width  = width;
+      m_height = height;
+
+      char header[64];
+      m_headerSize = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+
+      // the last byte sizes the file up front
+      unsigned char zero = 0;
+      if (fwrite(header, m_headerSize, 1, m_file) != 1 ||
+          !seek(getOffset(width - 1, 0) + 2) ||
+          fwrite(&zero, 1, 1, m_file) != 1)
+      {
+        close();
+        return false;
+      }
+      return true;
+    }
+
+    // rgb rows bottom-up as returned by glReadPixels, x and y from the
+    // bottom-left corner of the image
+    bool writeRect(int x, int y, int width, int height, const unsigned char* rgb)
+    {
+      if (!m_file) return false;
+
+      size_t rowSize = size_t(width) * 3;
+      for (int row = 0; row < height; row++){
+        if (!seek(getOffset(x, y + row)) ||
+            fwrite(rgb + rowSize * row, rowSize, 1, m_file) != 1)
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    bool close()
+    {
+      bool ok = true;
+      if (m_file) ok = fclose(m_file) == 0;
+      m_file = NULL;
+      return ok;
+    }
+
+    bool isOpen() const { return m_file != NULL; }
+
+  private:
+    // ppm rows are stored top-down
+    int64_t getOffset(int x, int y) const
+    {
+      return int64_t(m_headerSize) + (int64_t(m_height - 1 - y) * m_width + x) * 3;
+    }
+
+    bool seek(int64_t offset)
+    {
+#ifdef _WIN32
+      return _fseeki64(m_file, offset, SEEK_SET) == 0;
+#else
+      return fseeko(m_file, off_t(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    FILE*   m_file;
+    int     m_width;
+    int     m_height;
+    int     m_headerSize;
+  };
+}
+
+#endif
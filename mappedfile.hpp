@@ -0,0 +1,160 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// read-only memory mapping of an entire file
+// the pages are brought in by the OS on first access, so opening a file
+// is cheap and the actual i/o overlaps with whoever touches the data first
+
+class MappedFile {
+public:
+  MappedFile()
+    : m_data(NULL)
+    , m_size(0)
+#ifdef _WIN32
+    , m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(NULL)
+#endif
+  {
+  }
+
+  ~MappedFile()
+  {
+    close();
+  }
+
+  bool open(const char* filename)
+  {
+    close();
+#ifdef _WIN32
+    m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m_file == INVALID_HANDLE_VALUE){
+      return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0){
+      close();
+      return false;
+    }
+    m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m_mapping){
+      close();
+      return false;
+    }
+    m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    m_size = size_t(size.QuadPart);
+#else
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0){
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0){
+      ::close(fd);
+      return false;
+    }
+    void* ptr = mmap(NULL, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED){
+      return false;
+    }
+    m_data = ptr;
+    m_size = size_t(st.st_size);
+#endif
+    if (!m_data){
+      close();
+      return false;
+    }
+    return true;
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if (m_data)                         UnmapViewOfFile(m_data);
+    if (m_mapping)                      CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+    m_mapping = NULL;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_data) munmap(m_data, m_size);
+#endif
+    m_data = NULL;
+    m_size = 0;
+  }
+
+  // hint that the range will be read soon, starts reading ahead asynchronously
+  void prefetch(size_t offset, size_t size) const
+  {
+    if (!m_data || offset >= m_size) return;
+    if (offset + size > m_size) size = m_size - offset;
+#ifdef _WIN32
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (char*)m_data + offset;
+    range.NumberOfBytes  = size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    size_t page  = size_t(sysconf(_SC_PAGESIZE));
+    size_t begin = offset & ~(page - 1);
+    madvise((char*)m_data + begin, size + (offset - begin), MADV_WILLNEED);
+#endif
+  }
+
+  bool          isOpen() const  { return m_data != NULL; }
+  const void*   data() const    { return m_data; }
+  size_t        size() const    { return m_size; }
+
+private:
+  MappedFile(const MappedFile&);
+  MappedFile& operator=(const MappedFile&);
+
+  void*   m_data;
+  size_t  m_size;
+#ifdef _WIN32
+  HANDLE  m_file;
+  HANDLE  m_mapping;
+#endif
+};
+
+#endif
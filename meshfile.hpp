@@ -0,0 +1,212 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef MESHFILE_HPP
+#define MESHFILE_HPP
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "mappedfile.hpp"
+
+namespace ssao
+{
+  // File layout:
+  //
+  //   MeshHeader
+  //   MeshVertex[numVertices]    at vertexOffset
+  //   uint32_t[numIndices]       at indexOffset, triangle list
+  //   MeshObject[numObjects]     at objectOffset
+  //
+  // Sections start at MESH_ALIGNMENT. Vertices are stored exactly as the
+  // sample's vertex buffer expects them and indices are absolute, so both
+  // are copied into buffers as they are, nothing is parsed.
+  // tools/obj2mesh converts OBJ files.
+
+  static const char     MESH_MAGIC[8] = {'S','S','A','O','M','S','H','\0'};
+  static const uint32_t MESH_VERSION = 1;
+  static const uint64_t MESH_ALIGNMENT = 256;
+
+  struct MeshVertex {
+    float     position[4];
+    float     normal[4];
+    float     color[4];
+  };
+
+  struct MeshObject {
+    uint32_t  firstIndex;
+    uint32_t  numIndices;
+    uint32_t  firstVertex;
+    uint32_t  numVertices;
+    float     bboxMin[4];
+    float     bboxMax[4];
+  };
+
+  struct MeshHeader {
+    char      magic[8];
+    uint32_t  version;
+    uint32_t  vertexStride;   // sizeof(MeshVertex)
+    uint64_t  numVertices;
+    uint64_t  numIndices;
+    uint64_t  numObjects;
+    uint64_t  vertexOffset;
+    uint64_t  indexOffset;
+    uint64_t  objectOffset;
+    float     bboxMin[4];
+    float     bboxMax[4];
+  };
+
+  inline uint64_t getMeshAligned(uint64_t offset)
+  {
+    return (offset + MESH_ALIGNMENT - 1) & ~(MESH_ALIGNMENT - 1);
+  }
+
+  // objects must reference valid index and vertex ranges, the header
+  // is derived from them
+  inline bool writeMeshFile(const char* filename, const std::vector<MeshVertex>& vertices,
+    const std::vector<uint32_t>& indices, const std::vector<MeshObject>& objects)
+  {
+    MeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC));
+    header.version      = MESH_VERSION;
+    header.vertexStride = sizeof(MeshVertex);
+    header.numVertices  = vertices.size();
+    header.numIndices   = indices.size();
+    header.numObjects   = objects.size();
+    header.vertexOffset = getMeshAligned(sizeof(MeshHeader));
+    header.indexOffset  = getMeshAligned(header.vertexOffset + header.numVertices * sizeof(MeshVertex));
+    header.objectOffset = getMeshAligned(header.indexOffset + header.numIndices * sizeof(uint32_t));
+
+    for (int c = 0; c < 3; c++){
+      header.bboxMin[c] =  1e30f;
+      header.bboxMax[c] = -1e30f;
+    }
+    for (size_t i = 0; i < objects.size(); i++){
+      for (int c = 0; c < 3; c++){
+        header.bboxMin[c] = std::min(header.bboxMin[c], objects[i].bboxMin[c]);
+        header.bboxMax[c] = std::max(header.bboxMax[c], objects[i].bboxMax[c]);
+      }
+    }
+
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+
+    static const char zeros[MESH_ALIGNMENT] = {0};
+    bool ok = true;
+    uint64_t written = 0;
+
+    struct Section {
+      uint64_t    offset;
+      const void* data;
+      size_t      size;
+    } sections[] = {
+      {0,                   &header,                                      sizeof(header)},
+      {header.vertexOffset, vertices.empty() ? NULL : &vertices[0],       vertices.size() * sizeof(MeshVertex)},
+      {header.indexOffset,  indices.empty()  ? NULL : &indices[0],        indices.size() * sizeof(uint32_t)},
+      {header.objectOffset, objects.empty()  ? NULL : &objects[0],        objects.size() * sizeof(MeshObject)},
+    };
+
+    for (size_t s = 0; s < sizeof(sections)/sizeof(sections[0]) && ok; s++){
+      size_t padding = size_t(sections[s].offset - written);
+      ok = ok && (padding == 0 || fwrite(zeros, padding, 1, file) == 1);
+      ok = ok && (sections[s].size == 0 || fwrite(sections[s].data, sections[s].size, 1, file) == 1);
+      written = sections[s].offset + sections[s].size;
+    }
+
+    ok = fclose(file) == 0 && ok;
+    return ok;
+  }
+
+  class MeshReader {
+  public:
+    MeshReader() : m_header(NULL) {}
+
+    bool open(const char* filename)
+    {
+      close();
+      if (!m_file.open(filename) || m_file.size() < sizeof(MeshHeader)){
+        close();
+        return false;
+      }
+
+      const MeshHeader* header = (const MeshHeader*)m_file.data();
+      uint64_t size = m_file.size();
+      if (memcmp(header->magic, MESH_MAGIC, sizeof(MESH_MAGIC)) != 0 ||
+          header->version != MESH_VERSION ||
+          header->vertexStride != sizeof(MeshVertex) ||
+          header->vertexOffset + header->numVertices * sizeof(MeshVertex) > size ||
+          header->indexOffset + header->numIndices * sizeof(uint32_t) > size ||
+          header->objectOffset + header->numObjects * sizeof(MeshObject) > size)
+      {
+        close();
+        return false;
+      }
+
+      m_header = header;
+      return true;
+    }
+
+    void close()
+    {
+      m_file.close();
+      m_header = NULL;
+    }
+
+    bool                isOpen() const      { return m_header != NULL; }
+    const MeshHeader&   getHeader() const   { return *m_header; }
+
+    const MeshVertex* getVertices() const
+    {
+      return (const MeshVertex*)((const char*)m_file.data() + m_header->vertexOffset);
+    }
+
+    const uint32_t* getIndices() const
+    {
+      return (const uint32_t*)((const char*)m_file.data() + m_header->indexOffset);
+    }
+
+    const MeshObject* getObjects() const
+    {
+      return (const MeshObject*)((const char*)m_file.data() + m_header->objectOffset);
+    }
+
+    // start paging in a range ahead of its use
+    void prefetch(uint64_t offset, uint64_t size) const
+    {
+      m_file.prefetch(size_t(offset), size_t(size));
+    }
+
+  private:
+    MappedFile          m_file;
+    const MeshHeader*   m_header;
+  };
+}
+
+#endif
@@ -0,0 +1,363 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef READBACK_HPP
+#define READBACK_HPP
+
+#include <GL/glew.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "spscqueue.hpp"
+
+// Asynchronous readback of whole frames into a ring of pixel pack buffers.
+//
+// All slots live in one persistently mapped buffer. The render thread
+// acquires a free slot, issues its glReadPixels / glGetTextureImage into
+// the slot's offsets and submits it, which only places a fence. poll()
+// checks the fences of submitted slots in order without waiting and
+// hands completed ones to a consumer thread through a lock-free queue,
+// the consumer sleeps on a condition variable while the queue is empty.
+// The consumer passes pointers into the mapping to the sinks, nothing is
+// copied, and returns the slot through a second queue once all sinks are
+// done. When every slot is still in flight the frame is dropped instead
+// of stalling the renderer.
+//
+// Sinks run on the consumer thread and must not call GL.
+
+struct ReadbackFrame {
+  unsigned int          index;      // submitted frame, dropped ones are skipped
+  int                   width;      // color
+  int                   height;
+  int                   aoWidth;    // ao and depth
+  int                   aoHeight;
+  const unsigned char*  color;      // rgba8, bottom-up rows
+  const unsigned char*  ao;         // r8, bottom-up rows
+  const float*          depth;      // linear view depth, bottom-up rows
+};
+
+class ReadbackSink {
+public:
+  virtual ~ReadbackSink() {}
+  virtual void consume(const ReadbackFrame& frame) = 0;
+};
+
+// color as rgba8 frames back to back, vertically flipped, e.g. for
+// ffmpeg -f rawvideo -pix_fmt rgba -s WxH -i file -vf vflip out.mp4
+class ReadbackFileSink : public ReadbackSink {
+public:
+  ReadbackFileSink() : m_file(NULL) {}
+  ~ReadbackFileSink() { close(); }
+
+  bool isOpen() const { return m_file != NULL; }
+
+  bool open(const char* filename)
+  {
+    close();
+    m_file = fopen(filename, "wb");
+    return m_file != NULL;
+  }
+
+  void close()
+  {
+    if (m_file){
+      fclose(m_file);
+      m_file = NULL;
+    }
+  }
+
+  void consume(const ReadbackFrame& frame)
+  {
+    if (!m_file) return;
+    size_t size = size_t(frame.width) * size_t(frame.height) * 4;
+    if (fwrite(frame.color, size, 1, m_file) != 1){
+      fprintf(stderr, "readback: write failed, closing file\n");
+      close();
+    }
+  }
+
+private:
+  FILE*   m_file;
+};
+
+class ReadbackRing {
+public:
+  static const size_t ALIGNMENT = 256;
+
+  struct Stats {
+    unsigned int  submitted;
+    unsigned int  dropped;        // no free slot at acquire
+    unsigned int  consumed;
+    float         consumerTime;   // ms per frame in the sinks, running average
+  };
+
+  ReadbackRing()
+    : m_buffer(0)
+    , m_mapping(NULL)
+    , m_numSlots(0)
+    , m_slotSize(0)
+    , m_frameIndex(0)
+    , m_numReady(0)
+    , m_consumed(0)
+    , m_consumerTime(0)
+  {
+    memset(&m_stats, 0, sizeof(m_stats));
+  }
+
+  ~ReadbackRing()
+  {
+    deinit();
+  }
+
+  bool init(int numSlots, int width, int height, int aoWidth, int aoHeight, const std::vector<ReadbackSink*>& sinks)
+  {
+    deinit();
+
+    m_width     = width;
+    m_height    = height;
+    m_aoWidth   = aoWidth;
+    m_aoHeight  = aoHeight;
+    m_sinks     = sinks;
+
+    m_colorOffset = 0;
+    m_aoOffset    = alignedSize(m_colorOffset + size_t(width) * size_t(height) * 4);
+    m_depthOffset = alignedSize(m_aoOffset + size_t(aoWidth) * size_t(aoHeight));
+    m_slotSize    = alignedSize(m_depthOffset + size_t(aoWidth) * size_t(aoHeight) * sizeof(float));
+    m_numSlots    = numSlots;
+
+    // client storage, the driver should keep it in system memory as the cpu reads it
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m_buffer);
+    glNamedBufferStorageEXT(m_buffer, m_slotSize * numSlots, NULL, flags | GL_CLIENT_STORAGE_BIT);
+    m_mapping = (const unsigned char*)glMapNamedBufferRangeEXT(m_buffer, 0, m_slotSize * numSlots, flags);
+    if (!m_mapping){
+      glDeleteBuffers(1, &m_buffer);
+      m_buffer = 0;
+      m_numSlots = 0;
+      return false;
+    }
+
+    m_frames.resize(numSlots);
+    m_free.clear();
+    for (int i = numSlots - 1; i >= 0; i--){
+      m_free.push_back(i);
+    }
+    // one extra entry for the stop token
+    m_ready.reset(numSlots + 1);
+    m_released.reset(numSlots);
+    m_numReady = 0;
+    m_consumed.store(0);
+    m_consumerTime.store(0);
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    m_thread = std::thread(&ReadbackRing::consumer, this);
+    return true;
+  }
+
+  // waits for all outstanding frames to reach the sinks
+  void deinit()
+  {
+    if (!m_buffer) return;
+
+    while (!m_pending.empty()){
+      Pending& pending = m_pending.front();
+      glClientWaitSync(pending.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(~0ull));
+      glDeleteSync(pending.fence);
+      pushReady(pending.slot);
+      m_pending.pop_front();
+    }
+    pushReady(-1);
+    m_thread.join();
+
+    glUnmapNamedBufferEXT(m_buffer);
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer    = 0;
+    m_mapping   = NULL;
+    m_numSlots  = 0;
+  }
+
+  bool isActive() const
+  {
+    return m_buffer != 0;
+  }
+
+  bool matches(int width, int height, int aoWidth, int aoHeight) const
+  {
+    return isActive() && m_width == width && m_height == height && m_aoWidth == aoWidth && m_aoHeight == aoHeight;
+  }
+
+  // -1 drops the frame, every slot is still in flight or with the consumer
+  int acquire()
+  {
+    if (m_free.empty()){
+      m_stats.dropped++;
+      return -1;
+    }
+    int slot = m_free.back();
+    m_free.pop_back();
+    return slot;
+  }
+
+  // bind as GL_PIXEL_PACK_BUFFER, the offsets are relative to it
+  GLuint getBuffer() const                 { return m_buffer; }
+  size_t getColorOffset(int slot) const    { return m_slotSize * slot + m_colorOffset; }
+  size_t getAoOffset(int slot) const       { return m_slotSize * slot + m_aoOffset; }
+  size_t getDepthOffset(int slot) const    { return m_slotSize * slot + m_depthOffset; }
+
+  // after the read commands of the slot have been issued
+  void submit(int slot)
+  {
+    ReadbackFrame& frame = m_frames[slot];
+    const unsigned char* mapping = m_mapping + m_slotSize * slot;
+    frame.index     = m_frameIndex++;
+    frame.width     = m_width;
+    frame.height    = m_height;
+    frame.aoWidth   = m_aoWidth;
+    frame.aoHeight  = m_aoHeight;
+    frame.color     = mapping + m_colorOffset;
+    frame.ao        = mapping + m_aoOffset;
+    frame.depth     = (const float*)(mapping + m_depthOffset);
+
+    Pending pending = {slot, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)};
+    m_pending.push_back(pending);
+    m_stats.submitted++;
+  }
+
+  // once per frame on the render thread, never waits
+  void poll()
+  {
+    if (!m_buffer) return;
+
+    // fences complete in order, stop at the first one that has not
+    while (!m_pending.empty()){
+      Pending& pending = m_pending.front();
+      GLenum result = glClientWaitSync(pending.fence, 0, 0);
+      if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) break;
+
+      glDeleteSync(pending.fence);
+      pushReady(pending.slot);
+      m_pending.pop_front();
+    }
+
+    int slot;
+    while (m_released.pop(slot)){
+      m_free.push_back(slot);
+    }
+
+    m_stats.consumed      = m_consumed.load(std::memory_order_relaxed);
+    m_stats.consumerTime  = m_consumerTime.load(std::memory_order_relaxed);
+  }
+
+  const Stats& getStats() const
+  {
+    return m_stats;
+  }
+
+  static size_t alignedSize(size_t size)
+  {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+  }
+
+private:
+  struct Pending {
+    int     slot;
+    GLsync  fence;
+  };
+
+  void pushReady(int slot)
+  {
+    // cannot fail, a slot is only in one place at a time
+    m_ready.push(slot);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_numReady++;
+    }
+    m_cond.notify_one();
+  }
+
+  void consumer()
+  {
+    for (;;){
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cond.wait(lock, [this]{ return m_numReady > 0; });
+        m_numReady--;
+      }
+
+      // every count was pushed before it was signaled
+      int slot;
+      m_ready.pop(slot);
+      if (slot < 0) break;
+
+      std::chrono::high_resolution_clock::time_point begin = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < m_sinks.size(); i++){
+        m_sinks[i]->consume(m_frames[slot]);
+      }
+      float ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+      m_consumerTime.store(m_consumerTime.load(std::memory_order_relaxed) * 0.9f + ms * 0.1f, std::memory_order_relaxed);
+      m_consumed.fetch_add(1, std::memory_order_relaxed);
+      m_released.push(slot);
+    }
+  }
+
+  GLuint                      m_buffer;
+  const unsigned char*        m_mapping;
+  int                         m_numSlots;
+  size_t                      m_slotSize;
+  size_t                      m_colorOffset;
+  size_t                      m_aoOffset;
+  size_t                      m_depthOffset;
+  int                         m_width;
+  int                         m_height;
+  int                         m_aoWidth;
+  int                         m_aoHeight;
+  unsigned int                m_frameIndex;
+
+  std::vector<ReadbackSink*>  m_sinks;
+  std::vector<ReadbackFrame>  m_frames;     // written before the slot is queued
+  std::vector<int>            m_free;       // render thread only
+  std::deque<Pending>         m_pending;    // render thread only
+  SpscQueue<int>              m_ready;      // render -> consumer
+  SpscQueue<int>              m_released;   // consumer -> render
+  std::thread                 m_thread;
+  std::mutex                  m_mutex;
+  std::condition_variable     m_cond;
+  unsigned int                m_numReady;   // entries in m_ready, guarded by m_mutex
+
+  std::atomic<unsigned int>   m_consumed;
+  std::atomic<float>          m_consumerTime;
+  Stats                       m_stats;
+};
+
+#endif
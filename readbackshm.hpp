@@ -0,0 +1,248 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef READBACKSHM_HPP
+#define READBACKSHM_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <string>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "readback.hpp"
+
+// Publishes readback frames in named shared memory for another process,
+// e.g. a video encoder.
+//
+// Layout:
+//
+//   ShmHeader
+//   slot[numSlots], each ShmSlot followed by color, ao and depth as in
+//   ReadbackFrame, every part starting at SHM_ALIGNMENT
+//
+// Frame n goes to slot n % numSlots. A slot's sequence is odd while it
+// is written and even afterwards, so a reader copies the data, checks
+// that the sequence is even and unchanged and otherwise retries or skips
+// the frame. The writer never waits for readers, header.written is the
+// number of frames published so far.
+
+static const char     SHM_MAGIC[8] = {'S','S','A','O','S','H','M','\0'};
+static const uint32_t SHM_VERSION = 1;
+static const uint64_t SHM_ALIGNMENT = 256;
+
+struct ShmHeader {
+  char                    magic[8];
+  uint32_t                version;
+  uint32_t                numSlots;
+  uint64_t                slotSize;
+  uint64_t                colorOffset;  // within a slot
+  uint64_t                aoOffset;
+  uint64_t                depthOffset;
+  int32_t                 width;
+  int32_t                 height;
+  int32_t                 aoWidth;
+  int32_t                 aoHeight;
+  std::atomic<uint64_t>   written;
+};
+
+struct ShmSlot {
+  std::atomic<uint64_t>   sequence;
+  uint64_t                index;
+};
+
+class ReadbackShmSink : public ReadbackSink {
+public:
+  ReadbackShmSink()
+    : m_data(NULL)
+    , m_size(0)
+#ifdef _WIN32
+    , m_mapping(NULL)
+#endif
+  {
+  }
+
+  ~ReadbackShmSink()
+  {
+    close();
+  }
+
+  // the layout is fixed by the first frame, open again after size changes
+  bool open(const char* name, int numSlots, int width, int height, int aoWidth, int aoHeight)
+  {
+    close();
+
+    ShmHeader layout;
+    layout.numSlots    = uint32_t(numSlots);
+    layout.colorOffset = aligned(sizeof(ShmSlot));
+    layout.aoOffset    = aligned(layout.colorOffset + uint64_t(width) * uint64_t(height) * 4);
+    layout.depthOffset = aligned(layout.aoOffset + uint64_t(aoWidth) * uint64_t(aoHeight));
+    layout.slotSize    = aligned(layout.depthOffset + uint64_t(aoWidth) * uint64_t(aoHeight) * sizeof(float));
+    size_t size = size_t(aligned(sizeof(ShmHeader)) + layout.slotSize * numSlots);
+
+#ifdef _WIN32
+    m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+      DWORD(uint64_t(size) >> 32), DWORD(size), name);
+    if (!m_mapping){
+      return false;
+    }
+    m_data = (unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+    // posix names need a leading slash
+    m_name = name[0] == '/' ? std::string(name) : std::string("/") + name;
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0){
+      return false;
+    }
+    if (ftruncate(fd, off_t(size)) == 0){
+      void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      m_data = data == MAP_FAILED ? NULL : (unsigned char*)data;
+    }
+    ::close(fd);
+#endif
+    if (!m_data){
+      close();
+      return false;
+    }
+    m_size = size;
+
+    ShmHeader* header = getHeader();
+    memset(m_data, 0, aligned(sizeof(ShmHeader)));
+    header->version     = SHM_VERSION;
+    header->numSlots    = layout.numSlots;
+    header->slotSize    = layout.slotSize;
+    header->colorOffset = layout.colorOffset;
+    header->aoOffset    = layout.aoOffset;
+    header->depthOffset = layout.depthOffset;
+    header->width       = width;
+    header->height      = height;
+    header->aoWidth     = aoWidth;
+    header->aoHeight    = aoHeight;
+    header->written.store(0);
+    for (int i = 0; i < numSlots; i++){
+      getSlot(i)->sequence.store(0);
+    }
+    // readers check the magic last
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    return true;
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if (m_data){
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mapping){
+      CloseHandle(m_mapping);
+      m_mapping = NULL;
+    }
+#else
+    if (m_data){
+      munmap(m_data, m_size);
+    }
+    if (!m_name.empty()){
+      shm_unlink(m_name.c_str());
+      m_name.clear();
+    }
+#endif
+    m_data = NULL;
+    m_size = 0;
+  }
+
+  void consume(const ReadbackFrame& frame)
+  {
+    if (!m_data) return;
+
+    ShmHeader* header = getHeader();
+    if (frame.width != header->width || frame.height != header->height ||
+        frame.aoWidth != header->aoWidth || frame.aoHeight != header->aoHeight)
+    {
+      return;
+    }
+
+    uint64_t written = header->written.load(std::memory_order_relaxed);
+    ShmSlot* slot = getSlot(int(written % header->numSlots));
+    unsigned char* data = (unsigned char*)slot;
+
+    uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->index = frame.index;
+    memcpy(data + header->colorOffset, frame.color, size_t(frame.width) * size_t(frame.height) * 4);
+    memcpy(data + header->aoOffset,    frame.ao,    size_t(frame.aoWidth) * size_t(frame.aoHeight));
+    memcpy(data + header->depthOffset, frame.depth, size_t(frame.aoWidth) * size_t(frame.aoHeight) * sizeof(float));
+
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+    header->written.store(written + 1, std::memory_order_release);
+  }
+
+  bool isOpen() const
+  {
+    return m_data != NULL;
+  }
+
+private:
+  static uint64_t aligned(uint64_t size)
+  {
+    return (size + SHM_ALIGNMENT - 1) & ~(SHM_ALIGNMENT - 1);
+  }
+
+  ShmHeader* getHeader() const
+  {
+    return (ShmHeader*)m_data;
+  }
+
+  ShmSlot* getSlot(int idx) const
+  {
+    return (ShmSlot*)(m_data + aligned(sizeof(ShmHeader)) + getHeader()->slotSize * idx);
+  }
+
+  unsigned char*  m_data;
+  size_t          m_size;
+#ifdef _WIN32
+  HANDLE          m_mapping;
+#else
+  std::string     m_name;
+#endif
+};
+
+#endif
@@ -0,0 +1,452 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef RENDERGRAPH_HPP
+#define RENDERGRAPH_HPP
+
+#include <GL/glew.h>
+
+#include <stdio.h>
+
+#include "glstate.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Small render graph for sequences of fullscreen and compute passes.
+//
+// Passes are declared in logical order together with the textures they
+// read and write. Every write creates a new version of the texture, so a
+// pass reads exactly the contents it was declared against. Before
+// running, the graph
+//
+// - culls passes whose results do not contribute to the outputs,
+// - orders the remaining passes along their dependencies, preferring to
+//   stay on the current framebuffer,
+// - computes the lifetime of every texture and invalidates transient
+//   ones after their last use,
+// - issues glMemoryBarrier only where an image store is followed by an
+//   access that needs it, with just the bits that access needs.
+//
+// The framebuffer, viewport, blending and sample mask of graphics passes
+// are declared with the pass and applied by the graph through the state
+// cache, so consecutive passes on the same target cost no state changes.
+
+class RenderGraph {
+public:
+  typedef int Resource;   // one version of an imported texture
+  typedef int PassID;
+  typedef std::function<void()> Execute;
+
+  enum Access {
+    ACCESS_TEXTURE,       // sampler fetches
+    ACCESS_IMAGE,         // image load/store
+    ACCESS_ATTACHMENT,    // framebuffer attachment
+  };
+
+  enum Blend {
+    BLEND_NONE,
+    BLEND_MULTIPLY,       // dst * src
+  };
+
+  struct Target {
+    Target()
+      : fbo(0), drawBuffer(GL_NONE), width(0), height(0), blend(BLEND_NONE), sampleMask(~0u)
+    {
+    }
+    Target(GLuint fbo_, int width_, int height_, GLenum drawBuffer_ = GL_NONE)
+      : fbo(fbo_), drawBuffer(drawBuffer_), width(width_), height(height_), blend(BLEND_NONE), sampleMask(~0u)
+    {
+    }
+
+    GLuint      fbo;
+    GLenum      drawBuffer;   // GL_NONE keeps the fbo's draw buffers
+    int         width;
+    int         height;
+    Blend       blend;
+    GLbitfield  sampleMask;   // ~0 disables the sample mask
+  };
+
+  struct Lifetime {
+    int   first;    // position in the executed order, -1 if unused
+    int   last;
+  };
+
+  void reset()
+  {
+    m_textures.clear();
+    m_versions.clear();
+    m_passes.clear();
+    m_outputs.clear();
+    m_order.clear();
+  }
+
+  Resource importTexture(const char* name, GLuint texture, bool transient)
+  {
+    TextureInfo info;
+    info.name       = name;
+    info.texture    = texture;
+    info.transient  = transient;
+    info.lifetime.first = -1;
+    info.lifetime.last  = -1;
+    m_textures.push_back(info);
+
+    Version version = {int(m_textures.size()) - 1, -1};
+    m_versions.push_back(version);
+    return Resource(m_versions.size() - 1);
+  }
+
+  PassID addPass(const char* name, const Target& target, Execute execute)
+  {
+    Pass pass;
+    pass.name     = name;
+    pass.compute  = false;
+    pass.target   = target;
+    pass.execute  = execute;
+    m_passes.push_back(pass);
+    return PassID(m_passes.size() - 1);
+  }
+
+  PassID addComputePass(const char* name, Execute execute)
+  {
+    Pass pass;
+    pass.name     = name;
+    pass.compute  = true;
+    pass.execute  = execute;
+    m_passes.push_back(pass);
+    return PassID(m_passes.size() - 1);
+  }
+
+  void read(PassID pass, Resource res, Access access)
+  {
+    Use use = {res, access, false};
+    m_passes[pass].uses.push_back(use);
+  }
+
+  // returns the version holding the pass's result
+  Resource write(PassID pass, Resource res, Access access)
+  {
+    Version version = {m_versions[res].texture, pass};
+    m_versions.push_back(version);
+
+    Resource written = Resource(m_versions.size() - 1);
+    Use use = {written, access, true};
+    m_passes[pass].uses.push_back(use);
+    return written;
+  }
+
+  // read-modify-write, e.g. blending into the previous contents
+  Resource modify(PassID pass, Resource res, Access access)
+  {
+    read(pass, res, access);
+    return write(pass, res, access);
+  }
+
+  // passes not contributing to an output are culled
+  void addOutput(Resource res)
+  {
+    m_outputs.push_back(res);
+  }
+
+  // leaves the state of the last pass behind, with the depth test disabled
+  void execute(GLStateCache& state)
+  {
+    compile();
+
+    state.disable(GL_DEPTH_TEST);
+
+    for (size_t i = 0; i < m_order.size(); i++){
+      Pass& pass = m_passes[m_order[i]];
+
+      issueBarriers(state, pass);
+
+      if (!pass.compute){
+        const Target& target = pass.target;
+        state.bindFramebuffer(target.fbo);
+        if (target.drawBuffer != GL_NONE){
+          state.drawBuffer(target.drawBuffer);
+        }
+        state.viewport(0, 0, target.width, target.height);
+
+        if (target.blend == BLEND_MULTIPLY){
+          state.enable(GL_BLEND);
+          state.blendFunc(GL_ZERO, GL_SRC_COLOR);
+        }
+        else {
+          state.disable(GL_BLEND);
+        }
+
+        if (target.sampleMask != ~0u){
+          state.enable(GL_SAMPLE_MASK);
+          state.sampleMask(target.sampleMask);
+        }
+        else {
+          state.disable(GL_SAMPLE_MASK);
+        }
+      }
+
+      pass.execute();
+
+      for (size_t u = 0; u < pass.uses.size(); u++){
+        const Use& use = pass.uses[u];
+        if (use.write && use.access == ACCESS_IMAGE){
+          setIncoherent(m_textures[m_versions[use.res].texture].texture);
+        }
+      }
+
+      for (size_t t = 0; t < m_textures.size(); t++){
+        const TextureInfo& info = m_textures[t];
+        if (info.transient && info.lifetime.last == int(i)){
+          state.countCall();
+          glInvalidateTexImage(info.texture, 0);
+        }
+      }
+    }
+  }
+
+  GLuint getTexture(Resource res) const
+  {
+    return m_textures[m_versions[res].texture].texture;
+  }
+
+  // executed order, culled passes and lifetimes of the last execute
+  void print(std::string& text) const
+  {
+    char buffer[256];
+    for (size_t i = 0; i < m_order.size(); i++){
+      snprintf(buffer, sizeof(buffer), "%2d %s\n", int(i), m_passes[m_order[i]].name);
+      text += buffer;
+    }
+    for (size_t i = 0; i < m_passes.size(); i++){
+      if (!m_passes[i].culled) continue;
+      snprintf(buffer, sizeof(buffer), "   %s (culled)\n", m_passes[i].name);
+      text += buffer;
+    }
+    for (size_t i = 0; i < m_textures.size(); i++){
+      const TextureInfo& info = m_textures[i];
+      if (info.lifetime.first < 0) continue;
+      snprintf(buffer, sizeof(buffer), "   %-16s %2d - %2d%s\n", info.name, info.lifetime.first, info.lifetime.last, info.transient ? " transient" : "");
+      text += buffer;
+    }
+  }
+
+private:
+  struct TextureInfo {
+    const char* name;
+    GLuint      texture;
+    bool        transient;
+    Lifetime    lifetime;
+  };
+
+  struct Version {
+    int         texture;
+    int         writer;     // pass, -1 for the imported contents
+  };
+
+  struct Use {
+    Resource    res;
+    Access      access;
+    bool        write;
+  };
+
+  struct Pass {
+    const char*       name;
+    bool              compute;
+    Target            target;
+    Execute           execute;
+    std::vector<Use>  uses;
+    bool              culled;
+  };
+
+  // image stores not yet made visible to all kinds of access
+  struct Incoherent {
+    GLuint      texture;
+    GLbitfield  visible;    // barrier bits issued since the store
+  };
+
+  static GLbitfield getBarrierBit(Access access)
+  {
+    switch (access){
+    case ACCESS_TEXTURE:    return GL_TEXTURE_FETCH_BARRIER_BIT;
+    case ACCESS_IMAGE:      return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    case ACCESS_ATTACHMENT: return GL_FRAMEBUFFER_BARRIER_BIT;
+    }
+    return 0;
+  }
+
+  void compile()
+  {
+    size_t numPasses = m_passes.size();
+
+    // culling, walk backwards from the outputs
+    std::vector<bool> needed(m_versions.size(), false);
+    for (size_t i = 0; i < m_outputs.size(); i++){
+      needed[m_outputs[i]] = true;
+    }
+    for (size_t p = numPasses; p-- > 0;){
+      Pass& pass = m_passes[p];
+      pass.culled = true;
+      for (size_t u = 0; u < pass.uses.size(); u++){
+        if (pass.uses[u].write && needed[pass.uses[u].res]) pass.culled = false;
+      }
+      if (pass.culled) continue;
+      for (size_t u = 0; u < pass.uses.size(); u++){
+        if (!pass.uses[u].write) needed[pass.uses[u].res] = true;
+      }
+    }
+
+    // dependencies between the remaining passes, per texture:
+    // read after write, write after write and write after read
+    std::vector< std::vector<int> > successors(numPasses);
+    std::vector<int>                numDependencies(numPasses, 0);
+    std::vector<int>                lastWriter(m_textures.size(), -1);
+    std::vector< std::vector<int> > readers(m_textures.size());
+
+    for (size_t p = 0; p < numPasses; p++){
+      const Pass& pass = m_passes[p];
+      if (pass.culled) continue;
+
+      std::vector<int> dependencies;
+      for (size_t u = 0; u < pass.uses.size(); u++){
+        int t = m_versions[pass.uses[u].res].texture;
+        if (lastWriter[t] >= 0) dependencies.push_back(lastWriter[t]);
+        if (pass.uses[u].write){
+          dependencies.insert(dependencies.end(), readers[t].begin(), readers[t].end());
+        }
+      }
+      for (size_t u = 0; u < pass.uses.size(); u++){
+        int t = m_versions[pass.uses[u].res].texture;
+        if (pass.uses[u].write){
+          lastWriter[t] = int(p);
+          readers[t].clear();
+        }
+        else {
+          readers[t].push_back(int(p));
+        }
+      }
+
+      for (size_t d = 0; d < dependencies.size(); d++){
+        int dep = dependencies[d];
+        if (dep == int(p)) continue;
+        std::vector<int>& succ = successors[dep];
+        bool known = false;
+        for (size_t s = 0; s < succ.size(); s++){
+          if (succ[s] == int(p)) known = true;
+        }
+        if (!known){
+          succ.push_back(int(p));
+          numDependencies[p]++;
+        }
+      }
+    }
+
+    // ordering, among the ready passes prefer the one that stays on the
+    // current framebuffer (compute passes do not need one), otherwise
+    // keep the declared order
+    m_order.clear();
+    std::vector<bool> done(numPasses, false);
+    GLuint fbo = ~0u;
+    for (;;){
+      int next = -1;
+      for (size_t p = 0; p < numPasses; p++){
+        const Pass& pass = m_passes[p];
+        if (pass.culled || done[p] || numDependencies[p] > 0) continue;
+        if (next < 0) next = int(p);
+        if (pass.compute || pass.target.fbo == fbo){
+          next = int(p);
+          break;
+        }
+      }
+      if (next < 0) break;
+
+      done[next] = true;
+      m_order.push_back(next);
+      if (!m_passes[next].compute) fbo = m_passes[next].target.fbo;
+      for (size_t s = 0; s < successors[next].size(); s++){
+        numDependencies[successors[next][s]]--;
+      }
+    }
+
+    // lifetimes
+    for (size_t t = 0; t < m_textures.size(); t++){
+      m_textures[t].lifetime.first = -1;
+      m_textures[t].lifetime.last  = -1;
+    }
+    for (size_t i = 0; i < m_order.size(); i++){
+      const Pass& pass = m_passes[m_order[i]];
+      for (size_t u = 0; u < pass.uses.size(); u++){
+        Lifetime& lifetime = m_textures[m_versions[pass.uses[u].res].texture].lifetime;
+        if (lifetime.first < 0) lifetime.first = int(i);
+        lifetime.last = int(i);
+      }
+    }
+  }
+
+  void setIncoherent(GLuint texture)
+  {
+    for (size_t i = 0; i < m_incoherent.size(); i++){
+      if (m_incoherent[i].texture == texture){
+        m_incoherent[i].visible = 0;
+        return;
+      }
+    }
+    Incoherent incoherent = {texture, 0};
+    m_incoherent.push_back(incoherent);
+  }
+
+  void issueBarriers(GLStateCache& state, const Pass& pass)
+  {
+    GLbitfield barriers = 0;
+    for (size_t u = 0; u < pass.uses.size(); u++){
+      GLuint texture = m_textures[m_versions[pass.uses[u].res].texture].texture;
+      GLbitfield bit = getBarrierBit(pass.uses[u].access);
+      for (size_t i = 0; i < m_incoherent.size(); i++){
+        if (m_incoherent[i].texture == texture && !(m_incoherent[i].visible & bit)){
+          barriers |= bit;
+        }
+      }
+    }
+    if (!barriers) return;
+
+    state.memoryBarrier(barriers);
+
+    // a barrier covers all earlier stores, not just the ones of this texture
+    for (size_t i = 0; i < m_incoherent.size(); i++){
+      m_incoherent[i].visible |= barriers;
+    }
+  }
+
+  std::vector<TextureInfo>  m_textures;
+  std::vector<Version>      m_versions;
+  std::vector<Pass>         m_passes;
+  std::vector<Resource>     m_outputs;
+  std::vector<int>          m_order;
+
+  // persists across reset, stores of the previous execute may still be pending
+  std::vector<Incoherent>   m_incoherent;
+};
+
+#endif
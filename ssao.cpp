@@ -32,7 +32,6 @@
 #include <nv_math/nv_math_glsltypes.h>
 
 #include <nv_helpers_gl/error.hpp>
-#include <nv_helpers_gl/programmanager.hpp>
 #include <nv_helpers/geometry.hpp>
 #include <nv_helpers/misc.hpp>
 #include <nv_helpers_gl/glresources.hpp>
@@ -42,16 +41,31 @@
 
 // optimizes blur, by storing depth along with ssao calculation
 // avoids accessing two different textures
+// (default of the 'special blur' setting, all variants are built)
 #define USE_AO_SPECIALBLUR          1
 
 // optimizes the cache-aware technique by rendering all temporary layers at once
 // instead of individually
+// (default of the 'layered single pass' setting, all variants are built)
 #define USE_AO_LAYERED_SINGLEPASS   1
 
 using namespace nv_helpers;
 using namespace nv_helpers_gl;
 using namespace nv_math;
 #include "common.h"
+#include "depthcapture.hpp"
+#include "asyncprograms.hpp"
+#include "frameslots.hpp"
+#include "glstate.hpp"
+#include "rendergraph.hpp"
+#include "tuningcache.hpp"
+#include "chunkupload.hpp"
+#include "meshfile.hpp"
+#include "imagewriter.hpp"
+#include "readback.hpp"
+#include "readbackshm.hpp"
+
+#include <chrono>
 
 namespace ssao
 {
@@ -65,44 +79,157 @@ namespace ssao
   int const SAMPLE_MAJOR_VERSION(4);
   int const SAMPLE_MINOR_VERSION(3);
 
-  static const int  NUM_MRT = 8;
-  static const int  HBAO_RANDOM_SIZE = AO_RANDOMTEX_SIZE;
-  static const int  HBAO_RANDOM_ELEMENTS = HBAO_RANDOM_SIZE*HBAO_RANDOM_SIZE;
+  static const int  MAX_MRT = 8;
+  static const int  HBAO_RANDOM_MAXSIZE = AO_RANDOMTEX_MAXSIZE;
+  static const int  HBAO_RANDOM_MAXELEMENTS = HBAO_RANDOM_MAXSIZE*HBAO_RANDOM_MAXSIZE;
   static const int  MAX_SAMPLES = 8;
 
-  static const int        grid = 32;
+  // deinterleave writes 2x2 or 4x2 layers per draw (always 2x2 for factor 2),
+  // keep in sync with hbao_deinterleave.frag.glsl
+  inline int getDeinterleaveMRT(int factor, int mrt)
+  {
+    return factor == 2 ? 4 : mrt;
+  }
+
+  // dynamic ao resolution, each level reduces width and height by 1/8
+  static const int  AO_SCALE_LEVELS = 5;
+  static const int  AO_SCALE_COOLDOWN = 30;   // frames between level changes, covers timer latency
+  static const int  TIMER_SSAO = 0;
+
+  inline float getAoScale(int level)
+  {
+    return 1.0f - 0.125f * float(level);
+  }
+
+  // auto-tuning, frames per candidate
+  static const int  TUNE_WARMUP = 4;
+  static const int  TUNE_RUNS = 16;
+  // prefix of stored tuning results, bump when their fields change
+  static const int  TUNE_FORMAT = 3;
+
+  // compute hbao specializations, shared memory border in pixels, see hbao.comp.glsl
+  static const int  COMPUTE_APRONS[] = {4,8,16,32};
+  static const int  NUM_COMPUTE_APRONS = sizeof(COMPUTE_APRONS)/sizeof(COMPUTE_APRONS[0]);
+
+  // compute blur specializations, see hbao_blur.comp.glsl
+  static const int  BLUR_COMPUTE_RADII[] = {2,3,4,6};
+  static const int  NUM_BLUR_COMPUTE_RADII = sizeof(BLUR_COMPUTE_RADII)/sizeof(BLUR_COMPUTE_RADII[0]);
+
   static const float      globalscale = 16.0f;
 
+  // scene generation, objects per chunk (and random stream)
+  static const int        SCENE_CHUNK_OBJECTS = 256;
+  // scene files are uploaded in chunks of about this size
+  static const size_t     SCENE_CHUNK_BYTES = 4 * 1024 * 1024;
+
+  // tiled screenshots, output pixels per tile side and ao radius limit in
+  // pixels, the latter sizes the guard band around every tile
+  static const int        SHOT_TILE_SIZE = 2048;
+  static const int        SHOT_MAX_RADIUS = 256;
+
+  // readback ring depth, frames in flight between the GPU and the sinks
+  static const int        READBACK_SLOTS = 4;
+
   class Sample : public nv_helpers_gl::WindowProfiler
   {
-    ProgramManager progManager;
+  public:
+    Sample()
+      : m_autoTune(false)
+      , m_benchmark(false)
+      , m_sceneObjects(32*32)
+      , m_sceneLevels(4)
+      , m_sceneThreads(0)
+      , m_shot(false)
+      , m_shotFilename("gl_ssao_shot.ppm")
+      , m_shotWidth(15360)
+      , m_shotHeight(8640)
+      , m_shotTile(SHOT_TILE_SIZE)
+      , m_shotMaxRadius(SHOT_MAX_RADIUS)
+      , m_readback(false)
+      , m_readbackSlots(READBACK_SLOTS)
+    {
+    }
+
+    std::string   m_captureFilename;
+    std::string   m_replayFilename;
+    std::string   m_sceneFilename;  // replaces the generated scene, see meshfile.hpp
+    bool          m_autoTune;
+    bool          m_benchmark;      // runs benchmarkAlgorithms once at startup
+
+    // generated scene: stacks of boxes on a square grid
+    uint          m_sceneObjects;   // number of stacks
+    uint          m_sceneLevels;    // boxes per stack (depth complexity)
+    uint          m_sceneThreads;   // 0 uses all cores
+
+    // tiled screenshot of the current view, see tiledScreenshot
+    bool          m_shot;           // takes one at startup
+    std::string   m_shotFilename;
+    int           m_shotWidth;
+    int           m_shotHeight;
+    int           m_shotTile;
+    int           m_shotMaxRadius;
+
+    // asynchronous readback of every frame, see readbackFrame
+    bool          m_readback;       // starts enabled
+    std::string   m_readbackFilename; // raw rgba8 color stream
+    std::string   m_readbackShmName;  // shared memory for an external process, see readbackshm.hpp
+    int           m_readbackSlots;
+
+  private:
+    AsyncProgramManager progManager;
 
     enum AlgorithmType {
       ALGORITHM_NONE,
       ALGORITHM_HBAO_CACHEAWARE,
       ALGORITHM_HBAO_CLASSIC,
+      ALGORITHM_HBAO_COMPUTE,
+      ALGORITHM_HBAO_CHECKERBOARD,  // cache-aware, half of the layers per frame
       NUM_ALGORITHMS,
     };
 
+    enum MsaaMode {
+      MSAA_PER_SAMPLE,      // ao for every sample, applied with glSampleMaski
+      MSAA_RESOLVE_FIRST,   // ao once per pixel from the closest depth, applied to all samples
+    };
+
     struct {
-      ProgramManager::ProgramID
+      AsyncProgramManager::ProgramID
         draw_scene,
         depth_linearize,
         depth_linearize_msaa,
+        depth_linearize_msaa_closest,
         viewnormal,
+        viewnormal_msaa,
         bilateralblur,
         displaytex,
 
         hbao_calc,
         hbao_calc_blur,
+        hbao_calc_compute[NUM_COMPUTE_APRONS][2],       // without or with depth for the blur
         hbao_blur,
         hbao_blur2,
-
-        hbao2_deinterleave,
-        hbao2_calc,
-        hbao2_calc_blur,
+        hbao_blur_compute[NUM_BLUR_COMPUTE_RADII][2],   // full or reduced precision
+        hbao_blur_compute_msaa[NUM_BLUR_COMPUTE_RADII][2],
+        hbao_composite,
+        hbao_composite_msaa,
+
+        hbao2_deinterleave[2],    // 4 or 8 mrt
+        hbao2_calc[2],            // per layer or layered
+        hbao2_calc_blur[2][2],    // per layer or layered, full or reduced precision
+        hbao2_calc_blur_checkerboard[2],  // full or reduced precision
         hbao2_reinterleave,
-        hbao2_reinterleave_blur;
+        hbao2_reinterleave_blur,
+        hbao2_reinterleave_checkerboard[2], // without or with depth for the blur
+
+        // all msaa samples in one pass, see drawHbaoLayeredSamples
+        hbao2_deinterleave_msaa[2],         // full or reduced precision
+        hbao2_calc_msaa,
+        hbao2_calc_blur_msaa[2],            // full or reduced precision
+        hbao2_reinterleave_msaa,
+        hbao2_reinterleave_blur_msaa[2],    // full or reduced precision
+
+        hbao_upsample,
+        hbao_upsample_msaa;
 
     } programs;
 
@@ -113,30 +240,34 @@ namespace ssao
         viewnormal,
         hbao_calc,
         hbao2_deinterleave,
-        hbao2_calc;
+        hbao2_calc,
+        hbao_samples,         // no attachments, ao resolution, for image stores per msaa sample
+        scene_resolve;
     } fbos;
 
     struct {
       ResourceGLuint  
         scene_vbo,
-        scene_ibo,
-        scene_ubo,
-        hbao_ubo;
+        scene_ibo;
     } buffers;
 
     struct {
       ResourceGLuint
         scene_color,
         scene_depthstencil,
+        scene_resolve,        // single sampled color for the readback with msaa
         scene_depthlinear,
         scene_viewnormal,
         hbao_result,
         hbao_blur,
         hbao_random,
         hbao_randomview[MAX_SAMPLES],
-        hbao2_deptharray,
-        hbao2_depthview[HBAO_RANDOM_ELEMENTS],
-        hbao2_resultarray;
+        hbao2_deptharray,     // with msaa the layers of all samples
+        hbao2_depthview[HBAO_RANDOM_MAXELEMENTS],
+        hbao2_resultarray,    // with msaa the layers of all samples
+        hbao2_viewnormalarray,  // with msaa, one layer per sample
+        hbao_resultarray,       // with msaa, one layer per sample
+        hbao_blurarray;         // with msaa, one layer per sample
     } textures;
 
     struct Vertex {
@@ -151,6 +282,7 @@ namespace ssao
       nv_math::vec4   normal;
       nv_math::vec4   color;
     };
+    static_assert(sizeof(Vertex) == sizeof(MeshVertex), "scene files store vertices as they are");
 
 
     struct Tweak {
@@ -158,39 +290,109 @@ namespace ssao
 
         : algorithm(ALGORITHM_HBAO_CACHEAWARE)
         , samples(1)
+        , msaaMode(MSAA_PER_SAMPLE)
         , intensity(1.5f)
         , radius(2.f)
         , bias(0.1f)
         , blur(1)
         , blurSharpness(40.0f)
+        , blurCompute(1)
+        , blurRadius(3)
+        , capture(1)
+        , deinterleave(AO_RANDOMTEX_SIZE)
+        , framesInFlight(3)
+        , aoDynamic(0)
+        , aoBudget(1.0f)
+        , specialBlur(USE_AO_SPECIALBLUR)
+        , layered(USE_AO_LAYERED_SINGLEPASS)
+        , deinterleaveMRT(MAX_MRT)
+        , tune(0)
+        , tuneTolerance(0.01f)
+        , reducedPrecision(0)
+        , precisionReport(0)
+        , computeApron(0)
+        , benchmark(0)
+        , aoKernel(AO_KERNEL_HBAO)
+        , shot(0)
+        , readback(0)
+        , msaaLayered(1)
+        , printGraph(0)
       {}
 
       int             samples;
+      MsaaMode        msaaMode;
       AlgorithmType   algorithm;
       float           intensity;
       float           bias;
       float           radius;
       int             blur;
       float           blurSharpness;
+      int             blurCompute;
+      int             blurRadius;
+      int             capture;
+      int             deinterleave;
+      int             framesInFlight;
+      int             aoDynamic;
+      float           aoBudget;
+      int             specialBlur;
+      int             layered;
+      int             deinterleaveMRT;
+      int             tune;
+      float           tuneTolerance;
+      int             reducedPrecision;
+      int             precisionReport;
+      int             computeApron;     // 0 picks it from the radius
+      int             benchmark;
+      int             aoKernel;         // AO_KERNEL_HBAO or AO_KERNEL_GTAO, prepended to all shaders
+      int             shot;
+      int             readback;
+      int             msaaLayered;
+      int             printGraph;       // one frame, prints order, culling and lifetimes of the ao graph
     };
 
     Tweak      tweak;
     Tweak      tweakLast;
     uint       sceneTriangleIndices;
     uint       sceneObjects;
+    vec3       sceneCenter;
+    float      sceneDimension;
 
-    vec4f      hbaoRandom[HBAO_RANDOM_ELEMENTS * MAX_SAMPLES];
+    int        framebufferWidth;
+    int        framebufferHeight;
+
+    int        aoWidth;               // resolution of the ao intermediates
+    int        aoHeight;
+    int        aoLevel;
+    int        aoCooldown;
+    float      aoTime;
+    float      aoScale;
+
+    int        deinterleave;          // factor the active programs were built with
+    int        definesDeinterleave;   // factor of the current m_prepend
+    int        aoKernel;              // kernel the active programs were built with
+    int        definesKernel;         // kernel of the current m_prepend
+
+    CaptureWriter         captureWriter;
+    CaptureReader         replayReader;
+    uint                  replayFrame;
+    std::vector<uint>     captureDepth;
+
+    vec4f      hbaoRandom[HBAO_RANDOM_MAXELEMENTS * MAX_SAMPLES];
 
     struct Projection {
       float nearplane;
       float farplane;
       float fov;
       mat4  matrix;
+      int   fullHeight;       // height in pixels the fov spans, 0 is the rendered height
+      float maxRadiusPixels;
 
       Projection()
         : nearplane(0.1f)
         , farplane(100.0f)
         , fov((45.f))
+        , fullHeight(0)
+        , maxRadiusPixels(1e30f)
       {
 
       }
@@ -203,25 +405,158 @@ namespace ssao
     SceneData  sceneUbo;
     HBAOData   hbaoUbo;
 
+    // per frame uniforms: SceneData at the beginning of a slot, HBAOData after it
+    FrameSlots frameSlots;
+    size_t     hbaoUboOffset;
+
+    // all per frame GL calls go through it, counters are printed with the timers
+    GLStateCache glstate;
+    double       countersPrintTime;
+
     bool begin();
     void think(double time);
     void resize(int width, int height);
 
     void prepareHbaoData(const Projection& projection, int width, int height);
 
-    void drawLinearDepth(const Projection& projection, int width, int height, int sampleIdx);
-    void drawHbaoBlur(const Projection& projection, int width, int height, int sampleIdx);
-    void drawHbaoClassic(const Projection& projection, int width, int height, int sampleIdx);
-    void drawHbaoCacheAware(const Projection& projection, int width, int height, int sampleIdx);
+    // current version of every texture while the pass list is declared
+    struct AoResources {
+      RenderGraph::Resource
+        scene,
+        scene_depthstencil,
+        depthlinear,
+        viewnormal,
+        deptharray,
+        resultarray,
+        result,
+        blur;
+    };
+
+    RenderGraph aoGraph;
+
+    RenderGraph::Target getSceneTarget(int sampleIdx) const;
+
+    void addLinearDepthPass(RenderGraph& graph, AoResources& res, const Projection& projection, int width, int height, int sampleIdx);
+    void addHbaoClassicPasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene);
+    void addHbaoCacheAwarePasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene);
+    void addHbaoComputePasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene);
+    int  getComputeApronIdx() const;
+    int  getBlurComputeRadiusIdx() const;
+    RenderGraph::Resource addHbaoBlurPasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene);
+    void addHbaoUpsamplePass(RenderGraph& graph, AoResources& res, RenderGraph::Resource ao, const Projection& projection, int sampleIdx);
+    void addHbaoCompositePass(RenderGraph& graph, AoResources& res, RenderGraph::Resource ao, int sampleIdx);
+
+    void drawHbao(const Projection& projection, int sampleIdx);
+    void drawHbaoLayeredSamples(const Projection& projection);
+    void drawHbaoSamples(const Projection& projection);
+
+    // auto-tuning of the pipeline setup, results persist in tuningCache
+    TuningCache  tuningCache;
+    std::string  tuneKey;       // key the current setup was tuned or looked up for
+
+    std::string getTuneKey(int width, int height) const;
+    std::string getTuneName(const Tweak& config) const;
+    std::string formatTuneConfig(const Tweak& config) const;
+    bool parseTuneConfig(const std::string& value, Tweak& config) const;
+    void getTuneCandidates(std::vector<Tweak>& candidates) const;
+    void applyTuneConfig(const Tweak& config);
+    float runTuneCandidate(const Projection& projection, GLuint readFbo, int width, int height, std::vector<unsigned char>& ao);
+    void autoTune(const Projection& projection, int width, int height);
+
+    // offscreen setup shared by the auto-tuner and the precision report,
+    // keeps the scene color and measures at full ao resolution
+    struct AoMeasure {
+      GLuint  backup;
+      GLuint  readTexture;
+      GLuint  readFbo;
+      float   aoScale;
+    };
+
+    void beginAoMeasure(AoMeasure& measure, int width, int height);
+    void endAoMeasure(AoMeasure& measure, int width, int height);
+
+    // reduced against full precision with the current setup
+    float   precisionError;       // mean absolute ao difference
+    float   precisionMaxError;
+    void reportPrecision(const Projection& projection, int width, int height);
+
+    // all algorithms with the current setup, against classic
+    void benchmarkAlgorithms(const Projection& projection, int width, int height);
+
+    static void compareAo(const std::vector<unsigned char>& ao, const std::vector<unsigned char>& reference, float& mean, float& max);
+
+    float   focusDepth;           // view depth of the orbit center, sizes the compute apron
+
+    uint    checkerboardFrame;    // its parity selects the layers computed by ALGORITHM_HBAO_CHECKERBOARD
+    bool    checkerboardHistory;  // hbao2_resultarray holds all layers of the last frame
+
+    ReadbackRing      readback;
+    ReadbackFileSink  readbackFile;
+    ReadbackShmSink   readbackShm;
+    GLuint            readbackAo;   // texture holding the final ao of the last drawHbao
+
+    void initReadback(int width, int height);
+    // issues the reads into a free slot of the ring, the frame is dropped if there is none
+    void readbackFrame(int width, int height);
+
+    // reduced precision: r16f linear depth, ao and depth packed as rg16 unorm
+    bool isAoPacked() const {
+      return tweak.reducedPrecision && (tweak.specialBlur || isAoCheckerboard());
+    }
+    GLenum getFormatDepth() const {
+      return tweak.reducedPrecision ? GL_R16F : GL_R32F;
+    }
+    GLenum getFormatAO() const {
+      return tweak.specialBlur ? (tweak.reducedPrecision ? GL_RG16 : GL_RG16F) : GL_R8;
+    }
+    // checkerboard keeps the depth next to the ao to validate its history
+    GLenum getFormatAOArray() const {
+      return isAoCheckerboard() ? (isAoPacked() ? GL_RG16 : GL_RG16F) : getFormatAO();
+    }
+    bool isAoPerSample() const {
+      return tweak.samples > 1 && tweak.msaaMode == MSAA_PER_SAMPLE;
+    }
+    // the result array keeps the other half of the layers from the last
+    // frame, so every msaa sample would need its own
+    bool isAoCheckerboard() const {
+      return tweak.algorithm == ALGORITHM_HBAO_CHECKERBOARD && !isAoPerSample();
+    }
+    bool isAoScaled() const {
+      return aoWidth != framebufferWidth || aoHeight != framebufferHeight;
+    }
+    // per-sample cache-aware ao for all samples in one pass, restricted to
+    // the layered setup at full resolution with the compute blur
+    bool isAoSamplesLayered() const {
+      return tweak.msaaLayered && isAoPerSample() && tweak.algorithm == ALGORITHM_HBAO_CACHEAWARE && tweak.layered &&
+        (!tweak.blur || (tweak.specialBlur && tweak.blurCompute)) && !isAoScaled() && !tweak.readback;
+    }
+    bool updateAoScale();
 
     bool initProgram();
+    void updateProgramDefines();
+    void initRandomTexture(int factor);
     bool initScene();
+    bool loadScene();
+    void generateSceneChunk(const geometry::Mesh<Vertex>& box, size_t chunk, Vertex* vertices, uint* indices) const;
     bool initMisc();
     bool initFramebuffers(int width, int height, int samples);
+    bool initAoFramebuffers(int fullWidth, int fullHeight);
+    bool initCapture();
+
+    void captureFrame(const Projection& projection, const mat4& view, int width, int height);
+
+    // into fbos.scene, which is bound and cleared by the caller
+    void drawScene(const Projection& projection, const mat4& view, int width, int height);
+
+    // renders m_shotWidth x m_shotHeight in tiles and writes them to m_shotFilename
+    void tiledScreenshot(const Projection& projection, const mat4& view);
 
     CameraControl m_control;
 
     void end() {
+      readback.deinit();
+      frameSlots.deinit();
+      progManager.deletePrograms();
       TwTerminate();
     }
     // return true to prevent m_window updates
@@ -249,73 +584,163 @@ namespace ssao
 
     progManager.registerInclude("common.h", "common.h");
 
-    progManager.m_prepend = ProgramManager::format("#define AO_LAYERED %d\n", USE_AO_LAYERED_SINGLEPASS ? 1 : 0);
+    updateProgramDefines();
 
     programs.draw_scene = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "scene.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "scene.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "scene.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "scene.frag.glsl"));
 
     programs.bilateralblur = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "bilateralblur.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "bilateralblur.frag.glsl"));
 
     programs.depth_linearize = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define DEPTHLINEARIZE_MSAA 0\n", "depthlinearize.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define DEPTHLINEARIZE_MSAA 0\n", "depthlinearize.frag.glsl"));
 
     programs.depth_linearize_msaa = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define DEPTHLINEARIZE_MSAA 1\n", "depthlinearize.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define DEPTHLINEARIZE_MSAA 1\n", "depthlinearize.frag.glsl"));
+
+    programs.depth_linearize_msaa_closest = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define DEPTHLINEARIZE_MSAA 1\n#define DEPTHLINEARIZE_CLOSEST 1\n", "depthlinearize.frag.glsl"));
 
     programs.viewnormal = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "viewnormal.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "viewnormal.frag.glsl"));
+
+    programs.viewnormal_msaa = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define VIEWNORMAL_MSAA_LAYERED 1\n", "viewnormal.frag.glsl"));
 
     programs.displaytex = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "displaytex.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "displaytex.frag.glsl"));
 
     programs.hbao_calc = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_DEINTERLEAVED 0\n#define AO_BLUR 0\n", "hbao.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_DEINTERLEAVED 0\n#define AO_BLUR 0\n", "hbao.frag.glsl"));
 
     programs.hbao_calc_blur = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_DEINTERLEAVED 0\n#define AO_BLUR 1\n", "hbao.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_DEINTERLEAVED 0\n#define AO_BLUR 1\n", "hbao.frag.glsl"));
+
+    for (int i = 0; i < NUM_COMPUTE_APRONS; i++){
+      for (int blur = 0; blur < 2; blur++){
+        programs.hbao_calc_compute[i][blur] = progManager.createProgram(
+          AsyncProgramManager::Definition(GL_COMPUTE_SHADER,         AsyncProgramManager::format("#define APRON %d\n#define AO_BLUR %d\n", COMPUTE_APRONS[i], blur), "hbao.comp.glsl"));
+      }
+    }
 
     programs.hbao_blur = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR_PRESENT 0\n","hbao_blur.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR_PRESENT 0\n","hbao_blur.frag.glsl"));
 
     programs.hbao_blur2 = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR_PRESENT 1\n","hbao_blur.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR_PRESENT 1\n","hbao_blur.frag.glsl"));
+
+    for (int i = 0; i < NUM_BLUR_COMPUTE_RADII; i++){
+      for (int packed = 0; packed < 2; packed++){
+        programs.hbao_blur_compute[i][packed] = progManager.createProgram(
+          AsyncProgramManager::Definition(GL_COMPUTE_SHADER,         AsyncProgramManager::format("#define KERNEL_RADIUS %d\n#define AO_PACKED %d\n", BLUR_COMPUTE_RADII[i], packed), "hbao_blur.comp.glsl"));
+        programs.hbao_blur_compute_msaa[i][packed] = progManager.createProgram(
+          AsyncProgramManager::Definition(GL_COMPUTE_SHADER,         AsyncProgramManager::format("#define KERNEL_RADIUS %d\n#define AO_PACKED %d\n#define AO_MSAA_LAYERED 1\n", BLUR_COMPUTE_RADII[i], packed), "hbao_blur.comp.glsl"));
+      }
+    }
 
-    programs.hbao2_calc = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_DEINTERLEAVED 1\n#define AO_BLUR 0\n", "hbao.frag.glsl"));
+    programs.hbao_composite = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "hbao_composite.frag.glsl"));
 
-    programs.hbao2_calc_blur = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_DEINTERLEAVED 1\n#define AO_BLUR 1\n", "hbao.frag.glsl"));
+    programs.hbao_composite_msaa = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_MSAA_LAYERED 1\n", "hbao_composite.frag.glsl"));
 
-    programs.hbao2_deinterleave = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "hbao_deinterleave.frag.glsl"));
+    for (int layered = 0; layered < 2; layered++){
+      programs.hbao2_calc[layered] = progManager.createProgram(
+        AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+        AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        AsyncProgramManager::format("#define AO_DEINTERLEAVED 1\n#define AO_BLUR 0\n#define AO_LAYERED %d\n", layered), "hbao.frag.glsl"));
+
+      for (int packed = 0; packed < 2; packed++){
+        programs.hbao2_calc_blur[layered][packed] = progManager.createProgram(
+          AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+          AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        AsyncProgramManager::format("#define AO_DEINTERLEAVED 1\n#define AO_BLUR 1\n#define AO_LAYERED %d\n#define AO_PACKED %d\n", layered, packed), "hbao.frag.glsl"));
+      }
+    }
+
+    for (int packed = 0; packed < 2; packed++){
+      programs.hbao2_calc_blur_checkerboard[packed] = progManager.createProgram(
+        AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+        AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        AsyncProgramManager::format("#define AO_DEINTERLEAVED 1\n#define AO_BLUR 1\n#define AO_LAYERED 1\n#define AO_PACKED %d\n#define AO_CHECKERBOARD 1\n", packed), "hbao.frag.glsl"));
+    }
+
+    programs.hbao2_deinterleave[0] = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define NUM_MRT 4\n", "hbao_deinterleave.frag.glsl"));
+
+    programs.hbao2_deinterleave[1] = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define NUM_MRT 8\n", "hbao_deinterleave.frag.glsl"));
 
     programs.hbao2_reinterleave = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR 0\n","hbao_reinterleave.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR 0\n","hbao_reinterleave.frag.glsl"));
 
     programs.hbao2_reinterleave_blur = progManager.createProgram(
-      ProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
-      ProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR 1\n","hbao_reinterleave.frag.glsl"));
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR 1\n","hbao_reinterleave.frag.glsl"));
+
+    for (int blur = 0; blur < 2; blur++){
+      programs.hbao2_reinterleave_checkerboard[blur] = progManager.createProgram(
+        AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+        AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        AsyncProgramManager::format("#define AO_BLUR %d\n#define AO_CHECKERBOARD 1\n", blur), "hbao_reinterleave.frag.glsl"));
+    }
+
+    programs.hbao2_calc_msaa = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_DEINTERLEAVED 1\n#define AO_BLUR 0\n#define AO_LAYERED 1\n#define AO_MSAA_LAYERED 1\n", "hbao.frag.glsl"));
+
+    programs.hbao2_reinterleave_msaa = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define AO_BLUR 0\n#define AO_MSAA_LAYERED 1\n", "hbao_reinterleave.frag.glsl"));
+
+    for (int packed = 0; packed < 2; packed++){
+      programs.hbao2_deinterleave_msaa[packed] = progManager.createProgram(
+        AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+        AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        AsyncProgramManager::format("#define DEPTH_HALF %d\n", packed), "hbao_deinterleave_msaa.frag.glsl"));
+
+      programs.hbao2_calc_blur_msaa[packed] = progManager.createProgram(
+        AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+        AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        AsyncProgramManager::format("#define AO_DEINTERLEAVED 1\n#define AO_BLUR 1\n#define AO_LAYERED 1\n#define AO_PACKED %d\n#define AO_MSAA_LAYERED 1\n", packed), "hbao.frag.glsl"));
+
+      programs.hbao2_reinterleave_blur_msaa[packed] = progManager.createProgram(
+        AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+        AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        AsyncProgramManager::format("#define AO_BLUR 1\n#define AO_PACKED %d\n#define AO_MSAA_LAYERED 1\n", packed), "hbao_reinterleave.frag.glsl"));
+    }
+
+    // all programs were submitted before waiting, so they compile in parallel
+    programs.hbao_upsample = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define UPSAMPLE_MSAA 0\n", "hbao_upsample.frag.glsl"));
 
-    validated = progManager.areProgramsValid();
+    programs.hbao_upsample_msaa = progManager.createProgram(
+      AsyncProgramManager::Definition(GL_VERTEX_SHADER,          "fullscreenquad.vert.glsl"),
+      AsyncProgramManager::Definition(GL_FRAGMENT_SHADER,        "#define UPSAMPLE_MSAA 1\n", "hbao_upsample.frag.glsl"));
+
+    validated = progManager.finish();
 
     return validated;
   }
 
+  void Sample::updateProgramDefines()
+  {
+    progManager.m_prepend = AsyncProgramManager::format("#define AO_RANDOMTEX_SIZE %d\n#define AO_KERNEL %d\n", tweak.deinterleave, tweak.aoKernel);
+    definesDeinterleave = tweak.deinterleave;
+    definesKernel       = tweak.aoKernel;
+  }
+
   bool Sample::initMisc()
   {
     MTRand rng;
@@ -324,9 +749,7 @@ namespace ssao
 
     rng.seed((unsigned)0);
 
-    signed short hbaoRandomShort[HBAO_RANDOM_ELEMENTS*MAX_SAMPLES*4];
-
-    for(int i=0; i<HBAO_RANDOM_ELEMENTS*MAX_SAMPLES; i++)
+    for(int i=0; i<HBAO_RANDOM_MAXELEMENTS*MAX_SAMPLES; i++)
     {
       float Rand1 = rng.randExc();
       float Rand2 = rng.randExc();
@@ -337,6 +760,28 @@ namespace ssao
       hbaoRandom[i].y = sinf(Angle);
       hbaoRandom[i].z = Rand2;
       hbaoRandom[i].w = 0;
+    }
+
+    initRandomTexture(deinterleave);
+
+    size_t alignment = FrameSlots::getUniformAlignment();
+    hbaoUboOffset = FrameSlots::alignedSize(sizeof(SceneData), alignment);
+    if (!frameSlots.init(FrameSlots::alignedSize(hbaoUboOffset + sizeof(HBAOData), alignment))){
+      return false;
+    }
+
+    return true;
+  }
+
+  void Sample::initRandomTexture(int factor)
+  {
+    int elements = factor*factor;
+
+    // per msaa sample one layer of factor x factor jitters
+    std::vector<signed short> hbaoRandomShort(elements*MAX_SAMPLES*4);
+
+    for(int i=0; i<elements*MAX_SAMPLES; i++)
+    {
 #define SCALE ((1<<15))
       hbaoRandomShort[i*4+0] = (signed short)(SCALE*hbaoRandom[i].x);
       hbaoRandomShort[i*4+1] = (signed short)(SCALE*hbaoRandom[i].y);
@@ -347,8 +792,8 @@ namespace ssao
 
     newTexture(textures.hbao_random);
     glBindTexture(GL_TEXTURE_2D_ARRAY,textures.hbao_random);
-    glTexStorage3D (GL_TEXTURE_2D_ARRAY,1,GL_RGBA16_SNORM,HBAO_RANDOM_SIZE,HBAO_RANDOM_SIZE,MAX_SAMPLES);
-    glTexSubImage3D(GL_TEXTURE_2D_ARRAY,0,0,0,0, HBAO_RANDOM_SIZE,HBAO_RANDOM_SIZE,MAX_SAMPLES,GL_RGBA,GL_SHORT,hbaoRandomShort);
+    glTexStorage3D (GL_TEXTURE_2D_ARRAY,1,GL_RGBA16_SNORM,factor,factor,MAX_SAMPLES);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY,0,0,0,0, factor,factor,MAX_SAMPLES,GL_RGBA,GL_SHORT,&hbaoRandomShort[0]);
     glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D_ARRAY,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
     glBindTexture(GL_TEXTURE_2D_ARRAY,0);
@@ -362,100 +807,228 @@ namespace ssao
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
       glBindTexture(GL_TEXTURE_2D, 0);
     }
+  }
+
+  void Sample::generateSceneChunk(const geometry::Mesh<Vertex>& box, size_t chunk, Vertex* vertices, uint* indices) const
+  {
+    // one random stream per chunk, the result does not depend on the thread count
+    MTRand rng;
+    rng.seed(MTRand::uint32(chunk));
 
-    newBuffer(buffers.hbao_ubo);
-    glNamedBufferStorageEXT(buffers.hbao_ubo, sizeof(HBAOData), NULL, GL_DYNAMIC_STORAGE_BIT);
+    uint  grid      = std::max(1u, uint(ceilf(sqrtf(float(m_sceneObjects)))));
+    uint  boxVerts  = box.getVerticesCount();
+    uint  boxInds   = box.getTriangleIndicesCount();
+    const uint* boxIndices = (const uint*)&box.m_indicesTriangles[0];
 
-    return true;
+    uint  begin = uint(chunk) * SCENE_CHUNK_OBJECTS;
+    uint  end   = std::min(begin + SCENE_CHUNK_OBJECTS, m_sceneObjects);
+
+    for (uint i = begin; i < end; i++){
+
+      vec4 color(float(rng.randExc()),float(rng.randExc()),float(rng.randExc()),1.0f);
+      color *= 0.25f;
+      color += 0.75f;
+
+      vec2  posxy(float(i % grid), float(i / grid));
+
+      // same hills independent of the grid size
+      float frequency = 3.2f / float(grid);
+      float depth = sin(posxy.x*frequency) * cos(posxy.y*frequency) * 2.0f;
+
+      for (uint l = 0; l < m_sceneLevels; l++){
+        vec3  pos(posxy.x, posxy.y, depth);
+
+        float scale = globalscale * 0.5f/float(grid);
+        if (l != 0){
+          scale *= powf(0.9f,float(l));
+          scale *= float(rng.randExc())*0.5f + 0.5f;
+        }
+
+        vec3 size = vec3(scale);
+
+        size.z *= float(rng.randExc())*1.0f+1.0f;
+        if (l != 0){
+          size.z *= powf(0.7f,float(l));
+        }
+
+        pos -=  vec3( float(grid/2), float(grid/2), 0);
+        pos /=  float(grid) / globalscale;
+
+        depth += size.z;
+
+        pos.z = depth;
+
+        // translation * scale of the unit box, axis aligned normals stay as they are
+        uint  first = (i * m_sceneLevels + l) * boxVerts;
+        Vertex* out = vertices + (first - begin * m_sceneLevels * boxVerts);
+        for (uint v = 0; v < boxVerts; v++){
+          const Vertex& in = box.m_vertices[v];
+          out[v].position = vec4(in.position.x * size.x + pos.x, in.position.y * size.y + pos.y, in.position.z * size.z + pos.z, 1.0f);
+          out[v].normal   = in.normal;
+          out[v].color    = color;
+        }
+
+        uint* outIndices = indices + (i - begin) * m_sceneLevels * boxInds + l * boxInds;
+        for (uint n = 0; n < boxInds; n++){
+          outIndices[n] = boxIndices[n] + first;
+        }
+
+        depth += size.z;
+      }
+    }
   }
 
-  bool Sample::initScene()
+  bool Sample::loadScene()
   {
-    { // Scene Geometry
-      geometry::Mesh<Vertex>  scene;
-      const int LEVELS = 4;
-      
-      sceneObjects = 0;
-      for (int i = 0; i < grid * grid; i++){
+    MeshReader reader;
+    if (!reader.open(m_sceneFilename.c_str())){
+      fprintf(stderr, "could not open scene file %s\n", m_sceneFilename.c_str());
+      return false;
+    }
 
-        vec4 color(frand(),frand(),frand(),1.0f);
-        color *= 0.25f;
-        color += 0.75f;
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
 
-        vec2  posxy(i % grid, i / grid);
-        
-        float depth = sin(posxy.x*0.1f) * cos(posxy.y*0.1f) * 2.0f;
+    const MeshHeader& header = reader.getHeader();
+    if (!header.numIndices || header.numIndices > uint64_t(~0u) || header.numVertices > uint64_t(~0u)){
+      fprintf(stderr, "scene file %s: empty or more than 2^32 indices or vertices\n", m_sceneFilename.c_str());
+      return false;
+    }
 
+    size_t vertexSize = size_t(header.numVertices) * sizeof(MeshVertex);
+    size_t indexSize  = size_t(header.numIndices) * sizeof(uint32_t);
 
-        for (int l = 0; l < LEVELS; l++){
-          vec3  pos(posxy.x, posxy.y, depth);
+    // let the OS read ahead while the first chunks are copied
+    reader.prefetch(header.vertexOffset, header.indexOffset + indexSize - header.vertexOffset);
 
-          float scale = globalscale * 0.5f/float(grid);
-          if (l != 0){
-            scale *= powf(0.9f,float(l));
-            scale *= frand()*0.5f + 0.5f;
-          }
+    // vertices and indices are split into the same number of chunks
+    size_t numChunks = std::max((vertexSize + SCENE_CHUNK_BYTES - 1) / SCENE_CHUNK_BYTES, (indexSize + SCENE_CHUNK_BYTES - 1) / SCENE_CHUNK_BYTES);
+    size_t vertexChunkSize = FrameSlots::alignedSize((vertexSize + numChunks - 1) / numChunks, 16);
+    size_t indexChunkSize  = FrameSlots::alignedSize((indexSize  + numChunks - 1) / numChunks, 16);
 
-          vec3 size = vec3(scale);
-          
+    newBuffer(buffers.scene_ibo);
+    glNamedBufferStorageEXT(buffers.scene_ibo, indexSize, NULL, 0);
 
-          size.z *= frand()*1.0f+1.0f; 
-          if (l != 0){
-            size.z *= powf(0.7f,float(l));
-          }
+    newBuffer(buffers.scene_vbo);
+    glNamedBufferStorageEXT(buffers.scene_vbo, vertexSize, NULL, 0);
+
+    // the workers copy from the file mapping into the staging buffers
+    const unsigned char* vertices = (const unsigned char*)reader.getVertices();
+    const unsigned char* indices  = (const unsigned char*)reader.getIndices();
 
-          pos -=  vec3( grid/2, grid/2, 0);
-          pos /=  float(grid) / globalscale;
+    WorkPool pool(m_sceneThreads);
+    bool uploaded = ChunkedUpload::run(pool, buffers.scene_vbo, buffers.scene_ibo,
+      vertexSize, indexSize, vertexChunkSize, indexChunkSize, numChunks,
+      [&](size_t chunk, unsigned char* vertexChunk, unsigned char* indexChunk){
+        size_t offset = chunk * vertexChunkSize;
+        if (offset < vertexSize){
+          memcpy(vertexChunk, vertices + offset, std::min(vertexChunkSize, vertexSize - offset));
+        }
+        offset = chunk * indexChunkSize;
+        if (offset < indexSize){
+          memcpy(indexChunk, indices + offset, std::min(indexChunkSize, indexSize - offset));
+        }
+      });
+    if (!uploaded){
+      fprintf(stderr, "scene: could not map staging buffers\n");
+      return false;
+    }
 
-          depth += size.z;
+    sceneObjects          = uint(header.numObjects);
+    sceneTriangleIndices  = uint(header.numIndices);
 
-          pos.z = depth;
+    vec3 bboxMin(header.bboxMin[0], header.bboxMin[1], header.bboxMin[2]);
+    vec3 bboxMax(header.bboxMax[0], header.bboxMax[1], header.bboxMax[2]);
+    sceneCenter     = (bboxMin + bboxMax) * 0.5f;
+    sceneDimension  = std::max(nv_math::length(bboxMax - bboxMin), 0.001f);
 
-          mat4  matrix    = nv_math::translation_mat4( pos) * nv_math::scale_mat4( size);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    printf("scene: %s, %u objects, %u triangles, %.1f MB, loaded in %.1f ms on %u threads\n",
+      m_sceneFilename.c_str(), sceneObjects, sceneTriangleIndices / 3, double(vertexSize + indexSize) / (1024.0 * 1024.0),
+      ms, pool.getNumThreads());
 
-          uint  oldverts  = scene.getVerticesCount();
-          uint  oldinds   = scene.getTriangleIndicesCount();
+    return true;
+  }
 
-          geometry::Box<Vertex>::add(scene,matrix,2,2,2);
+  bool Sample::initScene()
+  {
+    sceneCenter     = vec3(0.0f);
+    sceneDimension  = globalscale;
 
-          for (uint v = oldverts; v < scene.getVerticesCount(); v++){
-            scene.m_vertices[v].color = color;
-          }
+    if (!m_sceneFilename.empty()){
+      if (!loadScene()){
+        return false;
+      }
 
-          depth += size.z;
-        }
+      // radius and clip planes were chosen for the generated scene, scale with the size
+      tweak.radius *= sceneDimension / globalscale;
+    }
+    else { // Scene Geometry
+      std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+      // every box is a transformed copy of this one
+      geometry::Mesh<Vertex>  box;
+      geometry::Box<Vertex>::add(box,nv_math::mat4(1.0f),2,2,2);
 
-        sceneObjects++;
+      size_t boxVerts = box.getVerticesCount();
+      size_t boxInds  = box.getTriangleIndicesCount();
+      size_t boxes    = size_t(m_sceneObjects) * size_t(m_sceneLevels);
+
+      if (boxes == 0 || boxes * boxVerts > size_t(~0u)){
+        fprintf(stderr, "scene: %u objects with %u levels do not fit 32-bit indices\n", m_sceneObjects, m_sceneLevels);
+        return false;
       }
 
-      sceneTriangleIndices = scene.getTriangleIndicesCount();
+      size_t numChunks        = (m_sceneObjects + SCENE_CHUNK_OBJECTS - 1) / SCENE_CHUNK_OBJECTS;
+      size_t vertexChunkSize  = SCENE_CHUNK_OBJECTS * m_sceneLevels * boxVerts * sizeof(Vertex);
+      size_t indexChunkSize   = SCENE_CHUNK_OBJECTS * m_sceneLevels * boxInds * sizeof(uint);
+      size_t vertexSize       = boxes * boxVerts * sizeof(Vertex);
+      size_t indexSize        = boxes * boxInds * sizeof(uint);
+
+      sceneObjects          = m_sceneObjects;
+      sceneTriangleIndices  = uint(boxes * boxInds);
 
+      // only written by copies from the staging buffers
       newBuffer(buffers.scene_ibo);
-      glNamedBufferStorageEXT(buffers.scene_ibo, scene.getTriangleIndicesSize(), &scene.m_indicesTriangles[0], 0);
+      glNamedBufferStorageEXT(buffers.scene_ibo, indexSize, NULL, 0);
 
       newBuffer(buffers.scene_vbo);
-      glBindBuffer(GL_ARRAY_BUFFER, buffers.scene_vbo);
-      glNamedBufferStorageEXT(buffers.scene_vbo, scene.getVerticesSize(), &scene.m_vertices[0], 0);
+      glNamedBufferStorageEXT(buffers.scene_vbo, vertexSize, NULL, 0);
+
+      WorkPool pool(m_sceneThreads);
+      bool uploaded = ChunkedUpload::run(pool, buffers.scene_vbo, buffers.scene_ibo,
+        vertexSize, indexSize, vertexChunkSize, indexChunkSize, numChunks,
+        [&](size_t chunk, unsigned char* vertices, unsigned char* indices){
+          generateSceneChunk(box, chunk, (Vertex*)vertices, (uint*)indices);
+        });
+      if (!uploaded){
+        fprintf(stderr, "scene: could not map staging buffers\n");
+        return false;
+      }
 
-      glVertexAttribFormat(VERTEX_COLOR,  4, GL_FLOAT, GL_FALSE,  offsetof(Vertex,color));
-      glVertexAttribBinding(VERTEX_COLOR, 0);
+      double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+      printf("scene: %u objects, %u levels, %u triangles, %.1f MB, generated in %.1f ms on %u threads\n",
+        m_sceneObjects, m_sceneLevels, sceneTriangleIndices / 3, double(vertexSize + indexSize) / (1024.0 * 1024.0),
+        ms, pool.getNumThreads());
 
-      glVertexAttribFormat(VERTEX_POS,    3, GL_FLOAT, GL_FALSE,  offsetof(Vertex,position));
-      glVertexAttribFormat(VERTEX_NORMAL, 3, GL_FLOAT, GL_FALSE,  offsetof(Vertex,normal));
-      glVertexAttribBinding(VERTEX_POS,   0);
-      glVertexAttribBinding(VERTEX_NORMAL,0);
     }
 
-    { // Scene UBO
-      newBuffer(buffers.scene_ubo);
-      glNamedBufferStorageEXT(buffers.scene_ubo, sizeof(SceneData), NULL, GL_DYNAMIC_STORAGE_BIT);
-    }
+    glBindBuffer(GL_ARRAY_BUFFER, buffers.scene_vbo);
+
+    glVertexAttribFormat(VERTEX_COLOR,  4, GL_FLOAT, GL_FALSE,  offsetof(Vertex,color));
+    glVertexAttribBinding(VERTEX_COLOR, 0);
+
+    glVertexAttribFormat(VERTEX_POS,    3, GL_FLOAT, GL_FALSE,  offsetof(Vertex,position));
+    glVertexAttribFormat(VERTEX_NORMAL, 3, GL_FLOAT, GL_FALSE,  offsetof(Vertex,normal));
+    glVertexAttribBinding(VERTEX_POS,   0);
+    glVertexAttribBinding(VERTEX_NORMAL,0);
 
     return true;
   }
 
   bool Sample::initFramebuffers(int width, int height, int samples)
   {
+    framebufferWidth  = width;
+    framebufferHeight = height;
 
     if (samples > 1){
       newTexture(textures.scene_color);
@@ -467,6 +1040,16 @@ namespace ssao
       glBindTexture (GL_TEXTURE_2D_MULTISAMPLE, textures.scene_depthstencil);
       glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, samples, GL_DEPTH24_STENCIL8, width, height, GL_FALSE);
       glBindTexture (GL_TEXTURE_2D_MULTISAMPLE, 0);
+
+      newTexture(textures.scene_resolve);
+      glBindTexture (GL_TEXTURE_2D, textures.scene_resolve);
+      glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+      glBindTexture (GL_TEXTURE_2D, 0);
+
+      newFramebuffer(fbos.scene_resolve);
+      glBindFramebuffer(GL_FRAMEBUFFER,     fbos.scene_resolve);
+      glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,  textures.scene_resolve, 0);
+      glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
     else
     {
@@ -487,10 +1070,22 @@ namespace ssao
     glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, textures.scene_depthstencil, 0);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+    return initAoFramebuffers(width, height);
+  }
+
+  // width and height are the full resolution, the ao intermediates
+  // are scaled by the current ao scale
+  bool Sample::initAoFramebuffers(int fullWidth, int fullHeight)
+  {
+    int width   = std::max(1, int(float(fullWidth)  * aoScale + 0.5f));
+    int height  = std::max(1, int(float(fullHeight) * aoScale + 0.5f));
+
+    aoWidth   = width;
+    aoHeight  = height;
 
     newTexture(textures.scene_depthlinear);
     glBindTexture (GL_TEXTURE_2D, textures.scene_depthlinear);
-    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, width, height);
+    glTexStorage2D(GL_TEXTURE_2D, 1, getFormatDepth(), width, height);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
@@ -518,14 +1113,11 @@ namespace ssao
 
     // hbao
 
-#if USE_AO_SPECIALBLUR
-    GLenum formatAO = GL_RG16F;
-    GLint swizzle[4] = {GL_RED,GL_GREEN,GL_ZERO,GL_ZERO};
-#else
-    GLenum formatAO = GL_R8;
-    GLint swizzle[4] = {GL_RED,GL_RED,GL_RED,GL_RED};
-#endif
-    
+    GLenum formatAO = getFormatAO();
+    GLint swizzleSpecial[4] = {GL_RED,GL_GREEN,GL_ZERO,GL_ZERO};
+    GLint swizzleRegular[4] = {GL_RED,GL_RED,GL_RED,GL_RED};
+    GLint* swizzle = tweak.specialBlur ? swizzleSpecial : swizzleRegular;
+
     newTexture(textures.hbao_result);
     glBindTexture (GL_TEXTURE_2D, textures.hbao_result);
     glTexStorage2D(GL_TEXTURE_2D, 1, formatAO, width, height);
@@ -550,21 +1142,27 @@ namespace ssao
 
     // interleaved hbao
 
-    int quarterWidth  = ((width+3)/4);
-    int quarterHeight = ((height+3)/4);
+    int factor   = deinterleave;
+    int elements = factor*factor;
+    int quarterWidth  = ((width+factor-1)/factor);
+    int quarterHeight = ((height+factor-1)/factor);
+
+    // with msaa the arrays hold the layers of every sample for
+    // drawHbaoLayeredSamples, the other paths use the first ones
+    int samples = std::max(1, tweak.samples);
 
     newTexture(textures.hbao2_deptharray);
     glBindTexture (GL_TEXTURE_2D_ARRAY, textures.hbao2_deptharray);
-    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, quarterWidth, quarterHeight, HBAO_RANDOM_ELEMENTS);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, getFormatDepth(), quarterWidth, quarterHeight, elements * samples);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glBindTexture (GL_TEXTURE_2D_ARRAY, 0);
 
-    for (int i = 0; i < HBAO_RANDOM_ELEMENTS; i++){
+    for (int i = 0; i < elements; i++){
       newTexture(textures.hbao2_depthview[i]);
-      glTextureView(textures.hbao2_depthview[i], GL_TEXTURE_2D, textures.hbao2_deptharray, GL_R32F, 0, 1, i, 1);
+      glTextureView(textures.hbao2_depthview[i], GL_TEXTURE_2D, textures.hbao2_deptharray, getFormatDepth(), 0, 1, i, 1);
       glBindTexture(GL_TEXTURE_2D, textures.hbao2_depthview[i]);
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
       glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -574,9 +1172,11 @@ namespace ssao
     }
 
 
+    // undefined contents, checkerboard starts over with all layers
     newTexture(textures.hbao2_resultarray);
+    checkerboardHistory = false;
     glBindTexture (GL_TEXTURE_2D_ARRAY, textures.hbao2_resultarray);
-    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, formatAO, quarterWidth, quarterHeight, HBAO_RANDOM_ELEMENTS);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, getFormatAOArray(), quarterWidth, quarterHeight, elements * samples);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -584,29 +1184,186 @@ namespace ssao
     glBindTexture (GL_TEXTURE_2D_ARRAY, 0);
 
 
-    GLenum drawbuffers[NUM_MRT];
-    for (int layer = 0; layer < NUM_MRT; layer++){
+    int numMRT = getDeinterleaveMRT(factor, tweak.deinterleaveMRT);
+
+    GLenum drawbuffers[MAX_MRT];
+    for (int layer = 0; layer < numMRT; layer++){
       drawbuffers[layer] = GL_COLOR_ATTACHMENT0 + layer;
     }
 
     newFramebuffer(fbos.hbao2_deinterleave);
     glBindFramebuffer(GL_FRAMEBUFFER,fbos.hbao2_deinterleave);
-    glDrawBuffers(NUM_MRT,drawbuffers);
+    glDrawBuffers(numMRT,drawbuffers);
     glBindFramebuffer(GL_FRAMEBUFFER,0);
 
     newFramebuffer(fbos.hbao2_calc);
     glBindFramebuffer(GL_FRAMEBUFFER,fbos.hbao2_calc);
-#if USE_AO_LAYERED_SINGLEPASS
-    // this fbo will not have any attachments and therefore requires rasterizer to be configured
+    // layered: this fbo will not have any attachments and therefore requires rasterizer to be configured
     // through default parameters
     glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_WIDTH,  quarterWidth);
     glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_HEIGHT, quarterHeight);
-#endif
     glBindFramebuffer(GL_FRAMEBUFFER,0);
 
+    if (samples > 1){
+      // per msaa sample intermediates at ao resolution, written with image stores
+      newTexture(textures.hbao2_viewnormalarray);
+      glBindTexture (GL_TEXTURE_2D_ARRAY, textures.hbao2_viewnormalarray);
+      glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, width, height, samples);
+      glBindTexture (GL_TEXTURE_2D_ARRAY, 0);
+
+      newTexture(textures.hbao_resultarray);
+      glBindTexture (GL_TEXTURE_2D_ARRAY, textures.hbao_resultarray);
+      glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, formatAO, width, height, samples);
+      glBindTexture (GL_TEXTURE_2D_ARRAY, 0);
+
+      newTexture(textures.hbao_blurarray);
+      glBindTexture (GL_TEXTURE_2D_ARRAY, textures.hbao_blurarray);
+      glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, formatAO, width, height, samples);
+      glBindTexture (GL_TEXTURE_2D_ARRAY, 0);
+
+      newFramebuffer(fbos.hbao_samples);
+      glBindFramebuffer(GL_FRAMEBUFFER,fbos.hbao_samples);
+      glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_WIDTH,  width);
+      glFramebufferParameteri(GL_FRAMEBUFFER, GL_FRAMEBUFFER_DEFAULT_HEIGHT, height);
+      glBindFramebuffer(GL_FRAMEBUFFER,0);
+    }
+
+    // texture names may be reused, also when called in the middle of a frame
+    glstate.invalidate();
+
+    return true;
+  }
+
+  bool Sample::initCapture()
+  {
+    replayFrame = 0;
+
+    if (!m_replayFilename.empty()){
+      if (!replayReader.open(m_replayFilename.c_str())){
+        fprintf(stderr, "could not open replay file %s\n", m_replayFilename.c_str());
+        return false;
+      }
+      // depth is uploaded straight from the file, which only works single-sampled
+      tweak.samples = 1;
+    }
+
+    if (!m_captureFilename.empty()){
+      int width  = m_window.m_viewsize[0];
+      int height = m_window.m_viewsize[1];
+      if (!captureWriter.open(m_captureFilename.c_str(), width, height)){
+        fprintf(stderr, "could not open capture file %s (existing captures must match the window size %d x %d)\n",
+          m_captureFilename.c_str(), width, height);
+        return false;
+      }
+      captureDepth.resize(size_t(width) * height);
+    }
+
     return true;
   }
 
+  void Sample::captureFrame(const Projection& projection, const mat4& view, int width, int height)
+  {
+    const CaptureHeader& header = captureWriter.getHeader();
+    if (tweak.samples > 1 || header.width != uint(width) || header.height != uint(height)){
+      // msaa depth cannot be read back directly, and all frames share one size
+      return;
+    }
+
+    CaptureFrame frame;
+    memcpy(frame.projection, projection.matrix.get_value(), sizeof(frame.projection));
+    memcpy(frame.view, view.get_value(), sizeof(frame.view));
+    frame.nearplane = projection.nearplane;
+    frame.farplane  = projection.farplane;
+    frame.fov       = projection.fov;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos.scene);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, &captureDepth[0]);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    if (!captureWriter.append(frame, &captureDepth[0])){
+      fprintf(stderr, "capture failed, stopping\n");
+      captureWriter.close();
+    }
+  }
+
+  void Sample::initReadback(int width, int height)
+  {
+    // drains the frames of the old size first
+    readback.deinit();
+
+    std::vector<ReadbackSink*> sinks;
+    if (!m_readbackFilename.empty()){
+      // frames of all sizes go to the same stream
+      if (readbackFile.isOpen() || readbackFile.open(m_readbackFilename.c_str())){
+        sinks.push_back(&readbackFile);
+      }
+      else {
+        fprintf(stderr, "readback: could not create %s\n", m_readbackFilename.c_str());
+        m_readbackFilename.clear();
+      }
+    }
+    if (!m_readbackShmName.empty()){
+      // the layout depends on the size, readers have to open it again
+      if (readbackShm.open(m_readbackShmName.c_str(), m_readbackSlots, width, height, aoWidth, aoHeight)){
+        sinks.push_back(&readbackShm);
+      }
+      else {
+        fprintf(stderr, "readback: could not create shared memory %s\n", m_readbackShmName.c_str());
+        m_readbackShmName.clear();
+      }
+    }
+
+    if (!readback.init(m_readbackSlots, width, height, aoWidth, aoHeight, sinks)){
+      fprintf(stderr, "readback: could not map the pack buffer, disabled\n");
+      tweak.readback = 0;
+      tweakLast.readback = 0;
+    }
+  }
+
+  void Sample::readbackFrame(int width, int height)
+  {
+    if (!readback.matches(width, height, aoWidth, aoHeight)){
+      initReadback(width, height);
+      if (!readback.isActive()) return;
+    }
+
+    int slot = readback.acquire();
+    if (slot < 0) return;
+
+    GLuint readFbo = fbos.scene;
+    if (tweak.samples > 1){
+      glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos.scene);
+      glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbos.scene_resolve);
+      glBlitFramebuffer(0,0,width,height, 0,0,width,height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+      glstate.countCall(3);
+      readFbo = fbos.scene_resolve;
+    }
+
+    // all reads only queue copies into the ring, the fence placed by
+    // submit tells when they have landed
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.getBuffer());
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFbo);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NV_BUFFER_OFFSET(readback.getColorOffset(slot)));
+    glstate.countCall(4);
+
+    if (readbackAo){
+      // the ao may come from an image store
+      glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+      glGetTextureImageEXT(readbackAo, GL_TEXTURE_2D, 0, GL_RED, GL_UNSIGNED_BYTE, NV_BUFFER_OFFSET(readback.getAoOffset(slot)));
+      glGetTextureImageEXT(textures.scene_depthlinear, GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, NV_BUFFER_OFFSET(readback.getDepthOffset(slot)));
+      glstate.countCall(3);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glstate.countCall(3);
+
+    readback.submit(slot);
+  }
+
 
   bool Sample::begin()
   {
@@ -623,6 +1380,29 @@ namespace ssao
     glGenVertexArrays(1, &defaultVAO);
     glBindVertexArray(defaultVAO);
 
+    deinterleave = tweak.deinterleave;
+    aoKernel     = tweak.aoKernel;
+
+    aoLevel     = 0;
+    aoCooldown  = 0;
+    aoTime      = 0;
+    aoScale     = 1.0f;
+
+    countersPrintTime = 0;
+
+    precisionError    = 0;
+    precisionMaxError = 0;
+    focusDepth        = 1.0f;
+    checkerboardFrame = 0;
+    checkerboardHistory = false;
+    readbackAo        = 0;
+
+    tuningCache.load(sysExePath() + std::string("gl_ssao_autotune.txt"));
+    tweak.benchmark = m_benchmark ? 1 : 0;
+    tweak.shot = m_shot ? 1 : 0;
+    tweak.readback = m_readback ? 1 : 0;
+
+    validated = validated && initCapture();
     validated = validated && initProgram();
     validated = validated && initMisc();
     validated = validated && initScene();
@@ -630,13 +1410,15 @@ namespace ssao
 
     TwBar *bar = TwNewBar("mainbar");
     TwDefine(" GLOBAL contained=true help='OpenGL samples.\nCopyright NVIDIA Corporation 2013-2014' ");
-    TwDefine(" mainbar position='0 0' size='300 150' color='0 0 0' alpha=128 valueswidth=120 ");
+    TwDefine(" mainbar position='0 0' size='300 700' color='0 0 0' alpha=128 valueswidth=120 ");
     TwDefine((std::string(" mainbar label='") + PROJECT_NAME + "'").c_str());
 
     TwEnumVal enumVals[] = {
       {ALGORITHM_NONE,"none"},
       {ALGORITHM_HBAO_CACHEAWARE,"hbao cache-aware"},
       {ALGORITHM_HBAO_CLASSIC,"hbao classic"},
+      {ALGORITHM_HBAO_COMPUTE,"hbao compute"},
+      {ALGORITHM_HBAO_CHECKERBOARD,"hbao checkerboard"},
     };
     TwType algorithmType = TwDefineEnum("algorithm", enumVals, sizeof(enumVals)/sizeof(enumVals[0]));
 
@@ -648,16 +1430,101 @@ namespace ssao
     };
     TwType samplesType = TwDefineEnum("samples", enumSampleVals, sizeof(enumSampleVals)/sizeof(enumSampleVals[0]));
 
+    TwEnumVal enumDeinterleaveVals[] = {
+      {2,"2x2"},
+      {4,"4x4"},
+      {8,"8x8"},
+    };
+    TwType deinterleaveType = TwDefineEnum("deinterleave", enumDeinterleaveVals, sizeof(enumDeinterleaveVals)/sizeof(enumDeinterleaveVals[0]));
+
+    TwEnumVal enumMsaaModeVals[] = {
+      {MSAA_PER_SAMPLE,"per sample"},
+      {MSAA_RESOLVE_FIRST,"resolve first"},
+    };
+    TwType msaaModeType = TwDefineEnum("msaamode", enumMsaaModeVals, sizeof(enumMsaaModeVals)/sizeof(enumMsaaModeVals[0]));
+
+    TwEnumVal enumKernelVals[] = {
+      {AO_KERNEL_HBAO,"hbao 8x4"},
+      {AO_KERNEL_GTAO,"gtao 2 slices"},
+    };
+    TwType kernelType = TwDefineEnum("kernel", enumKernelVals, sizeof(enumKernelVals)/sizeof(enumKernelVals[0]));
+
     TwAddVarRW(bar, "samples",  samplesType, &tweak.samples, " label='msaa' ");
+    TwAddVarRW(bar, "msaamode",  msaaModeType, &tweak.msaaMode, " label='msaa ao' ");
+    TwAddVarRW(bar, "msaalayered",  TW_TYPE_BOOL32, &tweak.msaaLayered, " label='msaa ao single pass' ");
     TwAddVarRW(bar, "algorithm",  algorithmType, &tweak.algorithm, " label='ssao algorithm' ");
+    TwAddVarRW(bar, "deinterleave",  deinterleaveType, &tweak.deinterleave, " label='deinterleave' ");
+    TwAddVarRW(bar, "kernel",  kernelType, &tweak.aoKernel, " label='ao kernel' ");
     TwAddVarRW(bar, "radius",  TW_TYPE_FLOAT, &tweak.radius, " label='radius' step=0.1 min=0 precision=2 ");
     TwAddVarRW(bar, "intensity",  TW_TYPE_FLOAT, &tweak.intensity, " label='intensity' min=0 step=0.1 ");
     TwAddVarRW(bar, "bias",  TW_TYPE_FLOAT, &tweak.bias, " label='bias' min=0 step=0.1 max=0.1");
     TwAddVarRW(bar, "bluractive",  TW_TYPE_BOOL32, &tweak.blur, " label='blur active' ");
     TwAddVarRW(bar, "blursharpness",  TW_TYPE_FLOAT, &tweak.blurSharpness, " label='blur sharpness' min=0 ");
+    TwEnumVal enumBlurRadiusVals[] = {
+      {2,"2"},
+      {3,"3"},
+      {4,"4"},
+      {6,"6"},
+    };
+    TwType blurRadiusType = TwDefineEnum("blurradius", enumBlurRadiusVals, sizeof(enumBlurRadiusVals)/sizeof(enumBlurRadiusVals[0]));
+
+    TwEnumVal enumApronVals[] = {
+      {0,"auto"},
+      {4,"4"},
+      {8,"8"},
+      {16,"16"},
+      {32,"32"},
+    };
+    TwType apronType = TwDefineEnum("apron", enumApronVals, sizeof(enumApronVals)/sizeof(enumApronVals[0]));
+
+    TwAddVarRW(bar, "apron",  apronType, &tweak.computeApron, " label='compute apron' ");
+    TwAddVarRW(bar, "blurcompute",  TW_TYPE_BOOL32, &tweak.blurCompute, " label='blur compute' ");
+    TwAddVarRW(bar, "blurradius",  blurRadiusType, &tweak.blurRadius, " label='blur compute radius' ");
+
+    TwEnumVal enumMRTVals[] = {
+      {4,"4"},
+      {8,"8"},
+    };
+    TwType mrtType = TwDefineEnum("mrt", enumMRTVals, sizeof(enumMRTVals)/sizeof(enumMRTVals[0]));
+
+    TwAddVarRW(bar, "specialblur",  TW_TYPE_BOOL32, &tweak.specialBlur, " label='special blur' ");
+    TwAddVarRW(bar, "layered",  TW_TYPE_BOOL32, &tweak.layered, " label='layered single pass' ");
+    TwAddVarRW(bar, "mrt",  mrtType, &tweak.deinterleaveMRT, " label='deinterleave mrt' ");
+    TwAddVarRW(bar, "tune",  TW_TYPE_BOOL32, &tweak.tune, " label='auto-tune now' ");
+    TwAddVarRW(bar, "tunetolerance",  TW_TYPE_FLOAT, &tweak.tuneTolerance, " label='auto-tune tolerance' min=0 step=0.005 precision=3 ");
+    TwAddVarRW(bar, "reducedprecision",  TW_TYPE_BOOL32, &tweak.reducedPrecision, " label='reduced precision' ");
+    TwAddVarRW(bar, "benchmark",  TW_TYPE_BOOL32, &tweak.benchmark, " label='benchmark algorithms now' ");
+    TwAddVarRW(bar, "precisionreport",  TW_TYPE_BOOL32, &tweak.precisionReport, " label='precision report now' ");
+    TwAddVarRW(bar, "shot",  TW_TYPE_BOOL32, &tweak.shot, " label='tiled screenshot now' ");
+    TwAddVarRW(bar, "printgraph",  TW_TYPE_BOOL32, &tweak.printGraph, " label='print render graph now' ");
+    TwAddVarRW(bar, "shotwidth",  TW_TYPE_INT32, &m_shotWidth, " label='screenshot width' min=1 ");
+    TwAddVarRW(bar, "shotheight",  TW_TYPE_INT32, &m_shotHeight, " label='screenshot height' min=1 ");
+    TwAddVarRW(bar, "readback",  TW_TYPE_BOOL32, &tweak.readback, " label='readback frames' ");
+    TwAddVarRO(bar, "readbacksubmitted",  TW_TYPE_UINT32, &readback.getStats().submitted, " label='readback submitted' ");
+    TwAddVarRO(bar, "readbackdropped",  TW_TYPE_UINT32, &readback.getStats().dropped, " label='readback dropped' ");
+    TwAddVarRO(bar, "readbackconsumed",  TW_TYPE_UINT32, &readback.getStats().consumed, " label='readback consumed' ");
+    TwAddVarRO(bar, "readbacktime",  TW_TYPE_FLOAT, &readback.getStats().consumerTime, " label='readback sink ms' precision=3 ");
+    TwAddVarRO(bar, "precisionerror",  TW_TYPE_FLOAT, &precisionError, " label='precision error mean' precision=4 ");
+    TwAddVarRO(bar, "precisionmaxerror",  TW_TYPE_FLOAT, &precisionMaxError, " label='precision error max' precision=4 ");
+    TwAddVarRW(bar, "framesinflight",  TW_TYPE_INT32, &tweak.framesInFlight, " label='frames in flight' min=1 max=4 ");
+    TwAddVarRW(bar, "aodynamic",  TW_TYPE_BOOL32, &tweak.aoDynamic, " label='dynamic ao resolution' ");
+    TwAddVarRW(bar, "aobudget",  TW_TYPE_FLOAT, &tweak.aoBudget, " label='ao budget ms' min=0.05 step=0.05 precision=2 ");
+    TwAddVarRO(bar, "aoscale",  TW_TYPE_FLOAT, &aoScale, " label='ao scale' precision=3 ");
+    TwAddVarRO(bar, "cpuwait",  TW_TYPE_FLOAT, &frameSlots.getStats().cpuWait, " label='cpu wait ms' precision=3 ");
+    TwAddVarRO(bar, "cpuframe",  TW_TYPE_FLOAT, &frameSlots.getStats().cpuFrame, " label='cpu frame ms' precision=3 ");
+    TwAddVarRO(bar, "gpuframe",  TW_TYPE_FLOAT, &frameSlots.getStats().gpuFrame, " label='gpu frame ms' precision=3 ");
+    TwAddVarRO(bar, "gpuidle",  TW_TYPE_FLOAT, &frameSlots.getStats().gpuIdle, " label='gpu idle ms' precision=3 ");
+    TwAddVarRO(bar, "glcalls",  TW_TYPE_UINT32, &glstate.getCounters().calls, " label='gl calls' ");
+    TwAddVarRO(bar, "glstate",  TW_TYPE_UINT32, &glstate.getCounters().stateChanges, " label='gl state changes' ");
+    TwAddVarRO(bar, "glredundant",  TW_TYPE_UINT32, &glstate.getCounters().redundant, " label='gl redundant skipped' ");
+    TwAddVarRO(bar, "gldraws",  TW_TYPE_UINT32, &glstate.getCounters().draws, " label='gl draws' ");
+    TwAddVarRO(bar, "glupload",  TW_TYPE_UINT32, &glstate.getCounters().uploadBytes, " label='gl upload bytes' ");
+    if (captureWriter.isOpen()){
+      TwAddVarRW(bar, "capture",  TW_TYPE_BOOL32, &tweak.capture, " label='capture depth' ");
+    }
 
-    m_control.m_sceneOrbit = vec3(0.0f);
-    m_control.m_sceneDimension = float(globalscale);
+    m_control.m_sceneOrbit = sceneCenter;
+    m_control.m_sceneDimension = sceneDimension;
     m_control.m_viewMatrix = nv_math::look_at(m_control.m_sceneOrbit - (vec3(0.4f,-0.35f,-0.6f)*m_control.m_sceneDimension*0.5f), m_control.m_sceneOrbit, vec3(0,1,0));
     
     return validated;
@@ -691,7 +1558,8 @@ namespace ssao
       projScale = float(height) / ( 8.0f /* FIXME need proper values for ortho */ );
     }
     else {
-      projScale = float(height) / (tanf( projection.fov * 0.5f) * 2.0f);
+      // tiles see part of a larger image, their pixels have its size
+      projScale = float(projection.fullHeight ? projection.fullHeight : height) / (tanf( projection.fov * 0.5f) * 2.0f);
     }
 
     // radius
@@ -700,256 +1568,1216 @@ namespace ssao
     hbaoUbo.R2 = R * R;
     hbaoUbo.NegInvR2 = -1.0f / hbaoUbo.R2;
     hbaoUbo.RadiusToScreen = R * 0.5f * projScale;
+    hbaoUbo.MaxRadiusPixels = projection.maxRadiusPixels;
 
     // ao
     hbaoUbo.PowExponent = std::max(tweak.intensity,0.0f);
     hbaoUbo.NDotVBias = std::min(std::max(0.0f, tweak.bias),1.0f);
     hbaoUbo.AOMultiplier = 1.0f / (1.0f - hbaoUbo.NDotVBias);
 
+    // packed depth is stored as fraction of the far plane
+    hbaoUbo.DepthPackScale = isAoPacked() ? 1.0f / projection.farplane : 1.0f;
+
+    hbaoUbo.CheckerboardParity = int(checkerboardFrame & 1);
+
     // resolution
-    int quarterWidth  = ((width+3)/4);
-    int quarterHeight = ((height+3)/4);
+    int factor = deinterleave;
+    int quarterWidth  = ((width+factor-1)/factor);
+    int quarterHeight = ((height+factor-1)/factor);
 
     hbaoUbo.InvQuarterResolution = vec2(1.0f/float(quarterWidth),1.0f/float(quarterHeight));
     hbaoUbo.InvFullResolution = vec2(1.0f/float(width),1.0f/float(height));
 
-#if USE_AO_LAYERED_SINGLEPASS
-    for (int i = 0; i < HBAO_RANDOM_ELEMENTS; i++){
-      hbaoUbo.float2Offsets[i] = vec2(float(i % 4) + 0.5f, float(i / 4) + 0.5f);
+    for (int i = 0; i < factor*factor; i++){
+      hbaoUbo.float2Offsets[i] = vec2(float(i % factor) + 0.5f, float(i / factor) + 0.5f);
       hbaoUbo.jitters[i] = hbaoRandom[i];
     }
-#endif
   }
 
-  void Sample::drawLinearDepth(const Projection& projection, int width, int height, int sampleIdx)
+  bool Sample::updateAoScale()
   {
-    NV_PROFILE_SECTION("linearize");
-    glBindFramebuffer(GL_FRAMEBUFFER, fbos.depthlinear);
+    int level = tweak.aoDynamic ? aoLevel : 0;
 
-    if (tweak.samples > 1){
-      glUseProgram(progManager.get(programs.depth_linearize_msaa));
-      glUniform4f(0,projection.nearplane * projection.farplane, projection.nearplane-projection.farplane, projection.farplane, 1.0f);
-      glUniform1i(1,sampleIdx);
+    float time;
+    if (tweak.aoDynamic && frameSlots.getTimer(TIMER_SSAO, time)){
+      aoTime = aoTime * 0.8f + time * 0.2f;
 
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D_MULTISAMPLE, textures.scene_depthstencil);
-      glDrawArrays(GL_TRIANGLES,0,3);
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D_MULTISAMPLE, 0);
+      if (aoCooldown > 0){
+        aoCooldown--;
+      }
+      else {
+        // cost scales with the pixel count, only go finer when the estimate
+        // for the next level stays well inside the budget (hysteresis)
+        float scale = getAoScale(aoLevel);
+        float finer = aoLevel > 0 ? getAoScale(aoLevel - 1) : scale;
+        float finerTime = aoTime * (finer * finer) / (scale * scale);
+
+        if (aoTime > tweak.aoBudget && aoLevel < AO_SCALE_LEVELS - 1){
+          level = aoLevel + 1;
+        }
+        else if (aoLevel > 0 && finerTime < tweak.aoBudget * 0.85f){
+          level = aoLevel - 1;
+        }
+      }
     }
-    else{
-      glUseProgram(progManager.get(programs.depth_linearize));
-      glUniform4f(0,projection.nearplane * projection.farplane, projection.nearplane-projection.farplane, projection.farplane, 1.0f);
 
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthstencil);
-      glDrawArrays(GL_TRIANGLES,0,3);
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, 0);
-    }
+    if (level == aoLevel) return false;
+
+    // start the estimate of the new level from the prediction
+    float ratio = getAoScale(level) / getAoScale(aoLevel);
+    aoTime     = aoTime * ratio * ratio;
+    aoLevel    = level;
+    aoScale    = getAoScale(level);
+    aoCooldown = AO_SCALE_COOLDOWN;
+    return true;
   }
 
-  void Sample::drawHbaoBlur(const Projection& projection, int width, int height, int sampleIdx)
+  RenderGraph::Target Sample::getSceneTarget(int sampleIdx) const
   {
-    NV_PROFILE_SECTION("ssaoblur");
-
-    float meters2viewspace = 1.0f;
-
-    glUseProgram(progManager.get(USE_AO_SPECIALBLUR ? programs.hbao_blur : programs.bilateralblur));
-    glBindMultiTextureEXT(GL_TEXTURE1, GL_TEXTURE_2D, textures.scene_depthlinear);
-
-    glUniform1f(0,tweak.blurSharpness/meters2viewspace);
-
-    glDrawBuffer(GL_COLOR_ATTACHMENT1);
-
-    glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao_result);
-    glUniform2f(1,1.0f/float(width),0);
-    glDrawArrays(GL_TRIANGLES,0,3);
-
-    // final output to main fbo
-    glBindFramebuffer(GL_FRAMEBUFFER, fbos.scene);
-    glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_ZERO,GL_SRC_COLOR);
-    if (tweak.samples > 1){
-      glEnable(GL_SAMPLE_MASK);
-      glSampleMaski(0, 1<<sampleIdx);
+    // the ao is multiplied into the scene, per sample msaa only into this sample,
+    // -1 covers all samples for passes shaded per sample
+    RenderGraph::Target target(fbos.scene, framebufferWidth, framebufferHeight);
+    target.blend = RenderGraph::BLEND_MULTIPLY;
+    if (isAoPerSample() && sampleIdx >= 0){
+      target.sampleMask = 1 << sampleIdx;
     }
+    return target;
+  }
 
-#if USE_AO_SPECIALBLUR
-    glUseProgram(progManager.get(programs.hbao_blur2));
-    glUniform1f(0,tweak.blurSharpness/meters2viewspace);
-#endif
+  void Sample::addLinearDepthPass(RenderGraph& graph, AoResources& res, const Projection& projection, int width, int height, int sampleIdx)
+  {
+    RenderGraph::PassID pass = graph.addPass("linearize", RenderGraph::Target(fbos.depthlinear, width, height),
+      [=]{
+        NV_PROFILE_SECTION("linearize");
+        GLenum target = tweak.samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
 
-    glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao_blur);
-    glUniform2f(1,0,1.0f/float(height));
-    glDrawArrays(GL_TRIANGLES,0,3);
+        if (tweak.samples == 1){
+          glstate.useProgram(progManager.get(programs.depth_linearize));
+        }
+        else if (isAoPerSample()){
+          glstate.useProgram(progManager.get(programs.depth_linearize_msaa));
+          glstate.uniform1i(1,sampleIdx);
+        }
+        else {
+          glstate.useProgram(progManager.get(programs.depth_linearize_msaa_closest));
+          glstate.uniform1i(3,tweak.samples);
+        }
+        glstate.uniform4f(0,projection.nearplane * projection.farplane, projection.nearplane-projection.farplane, projection.farplane, 1.0f);
+        glstate.uniform2f(2,float(framebufferWidth)/float(width), float(framebufferHeight)/float(height));
+
+        glstate.bindTexture(GL_TEXTURE0, target, textures.scene_depthstencil);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, res.scene_depthstencil, RenderGraph::ACCESS_TEXTURE);
+    res.depthlinear = graph.write(pass, res.depthlinear, RenderGraph::ACCESS_ATTACHMENT);
   }
 
-
-  void Sample::drawHbaoClassic(const Projection& projection, int width, int height, int sampleIdx)
+  void Sample::addHbaoClassicPasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene)
   {
-    prepareHbaoData(projection,width,height);
+    RenderGraph::Target target = toScene ? getSceneTarget(sampleIdx) : RenderGraph::Target(fbos.hbao_calc, aoWidth, aoHeight, GL_COLOR_ATTACHMENT0);
+
+    RenderGraph::PassID pass = graph.addPass("ssaocalc", target,
+      [=]{
+        NV_PROFILE_SECTION("ssaocalc");
+        glstate.useProgram(progManager.get( tweak.specialBlur && tweak.blur ? programs.hbao_calc_blur : programs.hbao_calc ));
+
+        glstate.bindUniformBuffer(0,frameSlots.getBuffer(),frameSlots.getOffset(hbaoUboOffset),sizeof(HBAOData));
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthlinear);
+        glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, textures.hbao_randomview[sampleIdx]);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    if (toScene){
+      res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
+    }
+    else {
+      res.result = graph.write(pass, res.result, RenderGraph::ACCESS_ATTACHMENT);
+    }
+  }
 
-    drawLinearDepth(projection,width,height,sampleIdx);
+  void Sample::addHbaoCacheAwarePasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene)
+  {
+    int factor   = deinterleave;
+    int elements = factor*factor;
+    int quarterWidth  = ((aoWidth+factor-1)/factor);
+    int quarterHeight = ((aoHeight+factor-1)/factor);
+
+    // only the layers of one parity, the others keep last frame's result,
+    // all of them when there is no complete result to keep
+    bool checkerboard = isAoCheckerboard() && checkerboardHistory;
+    int  parity       = hbaoUbo.CheckerboardParity;
+
+    RenderGraph::PassID pass = graph.addPass("viewnormal", RenderGraph::Target(fbos.viewnormal, aoWidth, aoHeight),
+      [=]{
+        NV_PROFILE_SECTION("viewnormal");
+        glstate.useProgram(progManager.get(programs.viewnormal));
+
+        glstate.uniform4fv(0, hbaoUbo.projInfo.get_value());
+        glstate.uniform1i (1, hbaoUbo.projOrtho);
+        glstate.uniform2fv(2, hbaoUbo.InvFullResolution.get_value());
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthlinear);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    res.viewnormal = graph.write(pass, res.viewnormal, RenderGraph::ACCESS_ATTACHMENT);
+
+    pass = graph.addPass("deinterleave", RenderGraph::Target(fbos.hbao2_deinterleave, quarterWidth, quarterHeight),
+      [=]{
+        NV_PROFILE_SECTION("deinterleave");
+        // every draw fills a block of blockWidth x 2 layers
+        int numMRT     = getDeinterleaveMRT(factor, tweak.deinterleaveMRT);
+        int blockWidth = numMRT / 2;
+
+        glstate.useProgram(progManager.get(programs.hbao2_deinterleave[numMRT == MAX_MRT ? 1 : 0]));
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthlinear);
+
+        for (int y = 0; y < factor; y += 2){
+          for (int x = 0; x < factor; x += blockWidth){
+            glstate.uniform4f(0, float(x) + 0.5f, float(y) + 0.5f, hbaoUbo.InvFullResolution.x, hbaoUbo.InvFullResolution.y);
+
+            for (int layer = 0; layer < numMRT; layer++){
+              int i = (y + layer / blockWidth) * factor + x + (layer % blockWidth);
+              glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + layer, textures.hbao2_depthview[i], 0);
+            }
+            glstate.countCall(numMRT);
+            glstate.drawArrays(GL_TRIANGLES,0,3);
+          }
+        }
+      });
+    graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    res.deptharray = graph.write(pass, res.deptharray, RenderGraph::ACCESS_ATTACHMENT);
+
+    pass = graph.addPass("ssaocalc", RenderGraph::Target(fbos.hbao2_calc, quarterWidth, quarterHeight),
+      [=]{
+        NV_PROFILE_SECTION("ssaocalc");
+        int layered = tweak.layered ? 1 : 0;
+        // the checkerboard history needs the depth, with or without blur
+        bool depth  = (tweak.specialBlur && tweak.blur) || isAoCheckerboard();
+        if (checkerboard && layered){
+          glstate.useProgram(progManager.get(programs.hbao2_calc_blur_checkerboard[isAoPacked()]));
+        }
+        else {
+          glstate.useProgram(progManager.get(depth ? programs.hbao2_calc_blur[layered][isAoPacked()] : programs.hbao2_calc[layered]));
+        }
+        glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, textures.scene_viewnormal);
 
-    {
-      NV_PROFILE_SECTION("ssaocalc");
+        glstate.bindUniformBuffer(0,frameSlots.getBuffer(),frameSlots.getOffset(hbaoUboOffset),sizeof(HBAOData));
 
-      if (tweak.blur){
-        glBindFramebuffer(GL_FRAMEBUFFER, fbos.hbao_calc);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
-      }
-      else{
-        glBindFramebuffer(GL_FRAMEBUFFER, fbos.scene);
-        glDisable(GL_DEPTH_TEST);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ZERO,GL_SRC_COLOR);
-        if (tweak.samples > 1){
-          glEnable(GL_SAMPLE_MASK);
-          glSampleMaski(0, 1<<sampleIdx);
+        if (layered){
+          // instead of drawing to each layer individually
+          // we draw all layers at once, and use image writes to update the array texture
+          // this buys additional performance :)
+          glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_deptharray);
+          glstate.bindImageTexture( 0, textures.hbao2_resultarray, 0, GL_TRUE, 0, GL_WRITE_ONLY, getFormatAOArray());
+          glstate.drawArrays(GL_TRIANGLES,0,3 * (checkerboard ? elements / 2 : elements));
+        }
+        else {
+          for (int i = 0; i < elements; i++){
+            if (checkerboard && ((i % factor + i / factor) & 1) != parity) continue;
+
+            glstate.uniform2f(0, float(i % factor) + 0.5f, float(i / factor) + 0.5f);
+            glstate.uniform4fv(1, hbaoRandom[i].get_value());
+
+            glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao2_depthview[i]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textures.hbao2_resultarray, 0, i);
+            glstate.countCall();
+
+            glstate.drawArrays(GL_TRIANGLES,0,3);
+          }
+        }
+      });
+    graph.read(pass, res.deptharray, RenderGraph::ACCESS_TEXTURE);
+    graph.read(pass, res.viewnormal, RenderGraph::ACCESS_TEXTURE);
+    if (checkerboard){
+      res.resultarray = graph.modify(pass, res.resultarray, tweak.layered ? RenderGraph::ACCESS_IMAGE : RenderGraph::ACCESS_ATTACHMENT);
+    }
+    else {
+      res.resultarray = graph.write(pass, res.resultarray, tweak.layered ? RenderGraph::ACCESS_IMAGE : RenderGraph::ACCESS_ATTACHMENT);
+    }
+
+    RenderGraph::Target target = toScene ? getSceneTarget(sampleIdx) : RenderGraph::Target(fbos.hbao_calc, aoWidth, aoHeight, GL_COLOR_ATTACHMENT0);
+
+    pass = graph.addPass("reinterleave", target,
+      [=]{
+        NV_PROFILE_SECTION("reinterleave");
+        bool blur = tweak.specialBlur && tweak.blur;
+        if (checkerboard){
+          glstate.useProgram(progManager.get(programs.hbao2_reinterleave_checkerboard[blur ? 1 : 0]));
+          glstate.bindUniformBuffer(0,frameSlots.getBuffer(),frameSlots.getOffset(hbaoUboOffset),sizeof(HBAOData));
+          glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, textures.scene_depthlinear);
         }
+        else {
+          glstate.useProgram(progManager.get(blur ? programs.hbao2_reinterleave_blur : programs.hbao2_reinterleave));
+        }
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_resultarray);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, res.resultarray, RenderGraph::ACCESS_TEXTURE);
+    if (checkerboard){
+      graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    }
+    if (toScene){
+      res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
+    }
+    else {
+      res.result = graph.write(pass, res.result, RenderGraph::ACCESS_ATTACHMENT);
+    }
+  }
+
+  int Sample::getComputeApronIdx() const
+  {
+    int apron = tweak.computeApron;
+    if (!apron){
+      // enough for the radius around the orbit center, closer pixels
+      // have a larger radius and fetch their outer taps from the texture
+      float radiusPixels = hbaoUbo.RadiusToScreen / std::max(focusDepth, 0.01f);
+      apron = COMPUTE_APRONS[NUM_COMPUTE_APRONS - 1];
+      for (int i = NUM_COMPUTE_APRONS - 1; i >= 0; i--){
+        if (float(COMPUTE_APRONS[i]) >= radiusPixels) apron = COMPUTE_APRONS[i];
       }
+    }
+
+    int idx = 0;
+    for (int i = 0; i < NUM_COMPUTE_APRONS; i++){
+      if (COMPUTE_APRONS[i] == apron) idx = i;
+    }
+    return idx;
+  }
 
-      glUseProgram(progManager.get( USE_AO_SPECIALBLUR && tweak.blur ? programs.hbao_calc_blur : programs.hbao_calc ));
+  int Sample::getBlurComputeRadiusIdx() const
+  {
+    int idx = 0;
+    for (int i = 0; i < NUM_BLUR_COMPUTE_RADII; i++){
+      if (BLUR_COMPUTE_RADII[i] == tweak.blurRadius) idx = i;
+    }
+    return idx;
+  }
 
-      glBindBufferBase(GL_UNIFORM_BUFFER,0,buffers.hbao_ubo);
-      glNamedBufferSubDataEXT(buffers.hbao_ubo,0,sizeof(HBAOData),&hbaoUbo);
+  void Sample::addHbaoComputePasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene)
+  {
+    int apronIdx = getComputeApronIdx();
 
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthlinear);
-      glBindMultiTextureEXT(GL_TEXTURE1, GL_TEXTURE_2D, textures.hbao_randomview[sampleIdx]);
-      glDrawArrays(GL_TRIANGLES,0,3);
+    RenderGraph::PassID pass = graph.addComputePass("ssaocalc",
+      [=]{
+        NV_PROFILE_SECTION("ssaocalc");
+        glstate.useProgram(progManager.get(programs.hbao_calc_compute[apronIdx][tweak.specialBlur && tweak.blur ? 1 : 0]));
+
+        glstate.bindUniformBuffer(0,frameSlots.getBuffer(),frameSlots.getOffset(hbaoUboOffset),sizeof(HBAOData));
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthlinear);
+        glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, textures.hbao_randomview[sampleIdx]);
+        glstate.bindImageTexture(0, textures.hbao_result, 0, GL_FALSE, 0, GL_WRITE_ONLY, getFormatAO());
+        glstate.dispatchCompute((aoWidth+15)/16, (aoHeight+15)/16, 1);
+      });
+    graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    res.result = graph.write(pass, res.result, RenderGraph::ACCESS_IMAGE);
+
+    if (toScene){
+      addHbaoCompositePass(graph, res, res.result, sampleIdx);
     }
+  }
+
+  void Sample::addHbaoCompositePass(RenderGraph& graph, AoResources& res, RenderGraph::Resource ao, int sampleIdx)
+  {
+    GLuint aoTexture = graph.getTexture(ao);
+
+    RenderGraph::PassID pass = graph.addPass("composite", getSceneTarget(sampleIdx),
+      [=]{
+        NV_PROFILE_SECTION("composite");
+        glstate.useProgram(progManager.get(programs.hbao_composite));
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, aoTexture);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, ao, RenderGraph::ACCESS_TEXTURE);
+    res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
+  }
+
+  RenderGraph::Resource Sample::addHbaoBlurPasses(RenderGraph& graph, AoResources& res, int sampleIdx, bool toScene)
+  {
+    // both variants are declared, the one that is not used gets culled
+    bool blurCompute = tweak.specialBlur && tweak.blurCompute;
 
-    if (tweak.blur){
-      drawHbaoBlur(projection,width,height,sampleIdx);
+    float meters2viewspace = 1.0f;
+    float sharpness = tweak.blurSharpness/meters2viewspace;
+    float sharpnessSpecial = sharpness / hbaoUbo.DepthPackScale;  // depth stored with the ao
+
+    RenderGraph::Resource blurred = res.result;
+
+    // fragment blur: horizontal hbao_result -> hbao_blur, vertical hbao_blur -> scene or hbao_result
+    RenderGraph::PassID pass = graph.addPass("ssaoblur", RenderGraph::Target(fbos.hbao_calc, aoWidth, aoHeight, GL_COLOR_ATTACHMENT1),
+      [=]{
+        NV_PROFILE_SECTION("ssaoblur");
+        glstate.useProgram(progManager.get(tweak.specialBlur ? programs.hbao_blur : programs.bilateralblur));
+        glstate.uniform1f(0,tweak.specialBlur ? sharpnessSpecial : sharpness);
+        glstate.uniform2f(1,1.0f/float(aoWidth),0);
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao_result);
+        glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, textures.scene_depthlinear);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, res.result, RenderGraph::ACCESS_TEXTURE);
+    if (!tweak.specialBlur){
+      graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    }
+    RenderGraph::Resource horizontal = graph.write(pass, res.blur, RenderGraph::ACCESS_ATTACHMENT);
+
+    bool fragmentToScene = toScene && !blurCompute;
+    RenderGraph::Target target = fragmentToScene ? getSceneTarget(sampleIdx) : RenderGraph::Target(fbos.hbao_calc, aoWidth, aoHeight, GL_COLOR_ATTACHMENT0);
+
+    pass = graph.addPass("ssaoblur2", target,
+      [=]{
+        NV_PROFILE_SECTION("ssaoblur2");
+        glstate.useProgram(progManager.get(tweak.specialBlur ? programs.hbao_blur2 : programs.bilateralblur));
+        glstate.uniform1f(0,tweak.specialBlur ? sharpnessSpecial : sharpness);
+        glstate.uniform2f(1,0,1.0f/float(aoHeight));
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao_blur);
+        glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, textures.scene_depthlinear);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, horizontal, RenderGraph::ACCESS_TEXTURE);
+    if (!tweak.specialBlur){
+      graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    }
+    if (fragmentToScene){
+      res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
+    }
+    else {
+      blurred = graph.write(pass, res.result, RenderGraph::ACCESS_ATTACHMENT);
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
-    glDisable(GL_SAMPLE_MASK);
-    glSampleMaski(0, ~0);
+    if (!tweak.specialBlur){
+      // the compute blur needs the depth stored with the ao
+      return blurred;
+    }
+
+    int radiusIdx = getBlurComputeRadiusIdx();
 
-    glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, 0);
-    glBindMultiTextureEXT(GL_TEXTURE1, GL_TEXTURE_2D, 0);
+    // compute blur: both directions in one dispatch, hbao_result -> hbao_blur
+    pass = graph.addComputePass("ssaoblur",
+      [=]{
+        NV_PROFILE_SECTION("ssaoblur");
+        glstate.useProgram(progManager.get(programs.hbao_blur_compute[radiusIdx][isAoPacked()]));
+        glstate.uniform1f(0,sharpnessSpecial);
 
-    glUseProgram(0);
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao_result);
+        glstate.bindImageTexture(0, textures.hbao_blur, 0, GL_FALSE, 0, GL_WRITE_ONLY, getFormatAO());
+        glstate.dispatchCompute((aoWidth+15)/16, (aoHeight+15)/16, 1);
+      });
+    graph.read(pass, res.result, RenderGraph::ACCESS_TEXTURE);
+    RenderGraph::Resource computed = graph.write(pass, res.blur, RenderGraph::ACCESS_IMAGE);
+
+    if (blurCompute){
+      blurred = computed;
+    }
+
+    if (toScene && blurCompute){
+      pass = graph.addPass("ssaoblur2", getSceneTarget(sampleIdx),
+        [=]{
+          NV_PROFILE_SECTION("ssaoblur2");
+          glstate.useProgram(progManager.get(programs.hbao_composite));
+          glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao_blur);
+          glstate.drawArrays(GL_TRIANGLES,0,3);
+        });
+      graph.read(pass, computed, RenderGraph::ACCESS_TEXTURE);
+      res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
+    }
+
+    return blurred;
   }
 
-  void Sample::drawHbaoCacheAware(const Projection& projection, int width, int height, int sampleIdx)
+  void Sample::addHbaoUpsamplePass(RenderGraph& graph, AoResources& res, RenderGraph::Resource ao, const Projection& projection, int sampleIdx)
   {
-    int quarterWidth  = ((width+3)/4);
-    int quarterHeight = ((height+3)/4);
+    GLuint aoTexture = graph.getTexture(ao);
+
+    RenderGraph::PassID pass = graph.addPass("upsample", getSceneTarget(sampleIdx),
+      [=]{
+        NV_PROFILE_SECTION("upsample");
+        GLenum target = tweak.samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+
+        glstate.useProgram(progManager.get(tweak.samples > 1 ? programs.hbao_upsample_msaa : programs.hbao_upsample));
+        glstate.uniform4f(0,projection.nearplane * projection.farplane, projection.nearplane-projection.farplane, projection.farplane, 1.0f);
+        glstate.uniform1i(1,sampleIdx);
+        glstate.uniform2f(2,float(aoWidth)/float(framebufferWidth), float(aoHeight)/float(framebufferHeight));
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, aoTexture);
+        glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, textures.scene_depthlinear);
+        glstate.bindTexture(GL_TEXTURE2, target, textures.scene_depthstencil);
+        glstate.drawArrays(GL_TRIANGLES,0,3);
+      });
+    graph.read(pass, ao, RenderGraph::ACCESS_TEXTURE);
+    graph.read(pass, res.depthlinear, RenderGraph::ACCESS_TEXTURE);
+    graph.read(pass, res.scene_depthstencil, RenderGraph::ACCESS_TEXTURE);
+    res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
+  }
 
-    prepareHbaoData(projection,width,height);
+  void Sample::drawHbao(const Projection& projection, int sampleIdx)
+  {
+    if (tweak.algorithm == ALGORITHM_NONE) return;
+
+    RenderGraph& graph = aoGraph;
+    graph.reset();
+
+    // the readback needs the final ao and the linear depth after the
+    // graph has run, so the chain then ends in a texture that is applied
+    // to the scene by a separate pass, like with a scaled ao
+    bool keepAo = tweak.readback != 0;
+
+    // intermediates are transient, their contents are invalidated after the last use
+    AoResources res;
+    res.scene               = graph.importTexture("scene_color",        textures.scene_color,        false);
+    res.scene_depthstencil  = graph.importTexture("scene_depthstencil", textures.scene_depthstencil, false);
+    res.depthlinear         = graph.importTexture("depthlinear",        textures.scene_depthlinear,  !keepAo);
+    res.viewnormal          = graph.importTexture("viewnormal",         textures.scene_viewnormal,   true);
+    res.deptharray          = graph.importTexture("deptharray",         textures.hbao2_deptharray,   true);
+    res.resultarray         = graph.importTexture("resultarray",        textures.hbao2_resultarray,  !isAoCheckerboard());
+    res.result              = graph.importTexture("hbao_result",        textures.hbao_result,        !keepAo);
+    res.blur                = graph.importTexture("hbao_blur",          textures.hbao_blur,          !keepAo);
+
+    // only the last stage of the chain writes to the scene, everything that
+    // does not lead there is culled (e.g. the blur when it is disabled)
+    bool scaled = isAoScaled();
+    bool toScene = !scaled && !keepAo;
+
+    addLinearDepthPass(graph, res, projection, aoWidth, aoHeight, sampleIdx);
+
+    switch(tweak.algorithm){
+    case ALGORITHM_HBAO_CLASSIC:
+      addHbaoClassicPasses(graph, res, sampleIdx, toScene && !tweak.blur);
+      break;
+    case ALGORITHM_HBAO_CACHEAWARE:
+    case ALGORITHM_HBAO_CHECKERBOARD:
+      addHbaoCacheAwarePasses(graph, res, sampleIdx, toScene && !tweak.blur);
+      break;
+    case ALGORITHM_HBAO_COMPUTE:
+      addHbaoComputePasses(graph, res, sampleIdx, toScene && !tweak.blur);
+      break;
+    }
 
-    drawLinearDepth(projection,width,height,sampleIdx);
+    RenderGraph::Resource blurred = addHbaoBlurPasses(graph, res, sampleIdx, toScene && tweak.blur);
+    RenderGraph::Resource ao = tweak.blur ? blurred : res.result;
 
-    {
-      NV_PROFILE_SECTION("viewnormal");
-      glBindFramebuffer(GL_FRAMEBUFFER, fbos.viewnormal);
+    if (scaled){
+      addHbaoUpsamplePass(graph, res, ao, projection, sampleIdx);
+    }
+    else if (keepAo){
+      addHbaoCompositePass(graph, res, ao, sampleIdx);
+    }
+    readbackAo = keepAo ? graph.getTexture(ao) : 0;
 
-      glUseProgram(progManager.get(programs.viewnormal));
+    graph.addOutput(res.scene);
+    graph.execute(glstate);
+
+    if (tweak.printGraph){
+      std::string text;
+      graph.print(text);
+      printf("render graph, sample %d:\n%s", sampleIdx, text.c_str());
+    }
+  }
 
-      glUniform4fv(0, 1, hbaoUbo.projInfo.get_value());
-      glUniform1i (1, hbaoUbo.projOrtho);
-      glUniform2fv(2, 1, hbaoUbo.InvFullResolution.get_value());
 
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthlinear);
-      glDrawArrays(GL_TRIANGLES,0,3);
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, 0);
+  void Sample::drawHbaoLayeredSamples(const Projection& projection)
+  {
+    RenderGraph& graph = aoGraph;
+    graph.reset();
+
+    int factor   = deinterleave;
+    int elements = factor*factor;
+    int samples  = tweak.samples;
+    int quarterWidth  = ((aoWidth+factor-1)/factor);
+    int quarterHeight = ((aoHeight+factor-1)/factor);
+
+    // the arrays hold all samples, result and blur one layer per sample
+    AoResources res;
+    res.scene               = graph.importTexture("scene_color",        textures.scene_color,           false);
+    res.scene_depthstencil  = graph.importTexture("scene_depthstencil", textures.scene_depthstencil,    false);
+    res.viewnormal          = graph.importTexture("viewnormal",         textures.hbao2_viewnormalarray, true);
+    res.deptharray          = graph.importTexture("deptharray",         textures.hbao2_deptharray,      true);
+    res.resultarray         = graph.importTexture("resultarray",        textures.hbao2_resultarray,     true);
+    res.result              = graph.importTexture("hbao_result",        textures.hbao_resultarray,      true);
+    res.blur                = graph.importTexture("hbao_blur",          textures.hbao_blurarray,        true);
+
+    // the fullscreen triangles of every draw are the samples, or samples
+    // times layers, and the passes write their layers with image stores.
+    // Linearize and deinterleave are merged as the depth is read per sample
+    RenderGraph::PassID pass = graph.addPass("deinterleave", RenderGraph::Target(fbos.hbao2_calc, quarterWidth, quarterHeight),
+      [=]{
+        NV_PROFILE_SECTION("deinterleave");
+        glstate.useProgram(progManager.get(programs.hbao2_deinterleave_msaa[tweak.reducedPrecision ? 1 : 0]));
+        glstate.uniform4f(0,projection.nearplane * projection.farplane, projection.nearplane-projection.farplane, projection.farplane, 1.0f);
+        glstate.uniform2f(1,float(aoWidth), float(aoHeight));
+        glstate.uniform2f(2,float(framebufferWidth)/float(aoWidth), float(framebufferHeight)/float(aoHeight));
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_MULTISAMPLE, textures.scene_depthstencil);
+        glstate.bindImageTexture(0, textures.hbao2_deptharray, 0, GL_TRUE, 0, GL_WRITE_ONLY, getFormatDepth());
+        glstate.drawArrays(GL_TRIANGLES,0,3 * samples);
+      });
+    graph.read(pass, res.scene_depthstencil, RenderGraph::ACCESS_TEXTURE);
+    res.deptharray = graph.write(pass, res.deptharray, RenderGraph::ACCESS_IMAGE);
+
+    pass = graph.addPass("viewnormal", RenderGraph::Target(fbos.hbao_samples, aoWidth, aoHeight),
+      [=]{
+        NV_PROFILE_SECTION("viewnormal");
+        glstate.useProgram(progManager.get(programs.viewnormal_msaa));
+
+        glstate.uniform4fv(0, hbaoUbo.projInfo.get_value());
+        glstate.uniform1i (1, hbaoUbo.projOrtho);
+        glstate.uniform2fv(2, hbaoUbo.InvFullResolution.get_value());
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_deptharray);
+        glstate.bindImageTexture(0, textures.hbao2_viewnormalarray, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glstate.drawArrays(GL_TRIANGLES,0,3 * samples);
+      });
+    graph.read(pass, res.deptharray, RenderGraph::ACCESS_TEXTURE);
+    res.viewnormal = graph.write(pass, res.viewnormal, RenderGraph::ACCESS_IMAGE);
+
+    pass = graph.addPass("ssaocalc", RenderGraph::Target(fbos.hbao2_calc, quarterWidth, quarterHeight),
+      [=]{
+        NV_PROFILE_SECTION("ssaocalc");
+        glstate.useProgram(progManager.get(tweak.blur ? programs.hbao2_calc_blur_msaa[isAoPacked()] : programs.hbao2_calc_msaa));
+
+        glstate.bindUniformBuffer(0,frameSlots.getBuffer(),frameSlots.getOffset(hbaoUboOffset),sizeof(HBAOData));
+
+        glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_deptharray);
+        glstate.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D_ARRAY, textures.hbao2_viewnormalarray);
+        glstate.bindImageTexture( 0, textures.hbao2_resultarray, 0, GL_TRUE, 0, GL_WRITE_ONLY, getFormatAO());
+        glstate.drawArrays(GL_TRIANGLES,0,3 * elements * samples);
+      });
+    graph.read(pass, res.deptharray, RenderGraph::ACCESS_TEXTURE);
+    graph.read(pass, res.viewnormal, RenderGraph::ACCESS_TEXTURE);
+    res.resultarray = graph.write(pass, res.resultarray, RenderGraph::ACCESS_IMAGE);
+
+    if (!tweak.blur){
+      // shaded per sample, every sample fetches its own layers
+      pass = graph.addPass("reinterleave", getSceneTarget(-1),
+        [=]{
+          NV_PROFILE_SECTION("reinterleave");
+          glstate.useProgram(progManager.get(programs.hbao2_reinterleave_msaa));
+          glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_resultarray);
+          glstate.drawArrays(GL_TRIANGLES,0,3);
+        });
+      graph.read(pass, res.resultarray, RenderGraph::ACCESS_TEXTURE);
+      res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
+    }
+    else {
+      pass = graph.addPass("reinterleave", RenderGraph::Target(fbos.hbao_samples, aoWidth, aoHeight),
+        [=]{
+          NV_PROFILE_SECTION("reinterleave");
+          glstate.useProgram(progManager.get(programs.hbao2_reinterleave_blur_msaa[isAoPacked()]));
+          glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_resultarray);
+          glstate.bindImageTexture(0, textures.hbao_resultarray, 0, GL_TRUE, 0, GL_WRITE_ONLY, getFormatAO());
+          glstate.drawArrays(GL_TRIANGLES,0,3 * samples);
+        });
+      graph.read(pass, res.resultarray, RenderGraph::ACCESS_TEXTURE);
+      res.result = graph.write(pass, res.result, RenderGraph::ACCESS_IMAGE);
+
+      int   radiusIdx = getBlurComputeRadiusIdx();
+      float sharpnessSpecial = tweak.blurSharpness / hbaoUbo.DepthPackScale;
+
+      pass = graph.addComputePass("ssaoblur",
+        [=]{
+          NV_PROFILE_SECTION("ssaoblur");
+          glstate.useProgram(progManager.get(programs.hbao_blur_compute_msaa[radiusIdx][isAoPacked()]));
+          glstate.uniform1f(0,sharpnessSpecial);
+
+          glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao_resultarray);
+          glstate.bindImageTexture(0, textures.hbao_blurarray, 0, GL_TRUE, 0, GL_WRITE_ONLY, getFormatAO());
+          glstate.dispatchCompute((aoWidth+15)/16, (aoHeight+15)/16, samples);
+        });
+      graph.read(pass, res.result, RenderGraph::ACCESS_TEXTURE);
+      res.blur = graph.write(pass, res.blur, RenderGraph::ACCESS_IMAGE);
+
+      pass = graph.addPass("composite", getSceneTarget(-1),
+        [=]{
+          NV_PROFILE_SECTION("composite");
+          glstate.useProgram(progManager.get(programs.hbao_composite_msaa));
+          glstate.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao_blurarray);
+          glstate.drawArrays(GL_TRIANGLES,0,3);
+        });
+      graph.read(pass, res.blur, RenderGraph::ACCESS_TEXTURE);
+      res.scene = graph.modify(pass, res.scene, RenderGraph::ACCESS_ATTACHMENT);
     }
 
+    graph.addOutput(res.scene);
+    graph.execute(glstate);
+
+    if (tweak.printGraph){
+      std::string text;
+      graph.print(text);
+      printf("render graph, all samples:\n%s", text.c_str());
+    }
+  }
+
+  void Sample::drawHbaoSamples(const Projection& projection)
+  {
+    // set by drawHbao, with per-sample ao the last sample's remains
+    readbackAo = 0;
+
+    if (isAoSamplesLayered()){
+      drawHbaoLayeredSamples(projection);
+    }
+    else {
+      // resolve-first runs the pipeline once and blends into all samples
+      int passes = isAoPerSample() ? tweak.samples : 1;
+      for (int sample = 0; sample < passes; sample++)
+      {
+        drawHbao(projection, sample);
+      }
+    }
+
+    // the next frame computes the other half, after other modes the
+    // array is undefined (transient) and needs a full frame first
+    checkerboardFrame++;
+    checkerboardHistory = isAoCheckerboard();
+
+    // once for all samples, the passes leave their state behind
+    glstate.enable(GL_DEPTH_TEST);
+    glstate.disable(GL_BLEND);
+    glstate.disable(GL_SAMPLE_MASK);
+    glstate.sampleMask(~0u);
+    glstate.useProgram(0);
+  }
+
+  std::string Sample::getTuneKey(int width, int height) const
+  {
+    // the candidates also depend on msaa and the deinterleave factor
+    return AsyncProgramManager::format("%s / %s / %dx%d / msaa %d%s / deinterleave %d%s",
+      (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION),
+      width, height, tweak.samples, tweak.samples > 1 && !isAoPerSample() ? " resolve-first" : "", deinterleave,
+      aoKernel == AO_KERNEL_GTAO ? " / gtao" : "");
+  }
+
+  std::string Sample::getTuneName(const Tweak& config) const
+  {
+    const char* precision = config.reducedPrecision ? " reduced" : "";
+    if (config.algorithm == ALGORITHM_HBAO_CLASSIC){
+      return AsyncProgramManager::format("classic%s%s", config.specialBlur ? " specialblur" : "", precision);
+    }
+    if (config.algorithm == ALGORITHM_HBAO_COMPUTE){
+      return AsyncProgramManager::format("compute%s apron %d%s", config.specialBlur ? " specialblur" : "", config.computeApron, precision);
+    }
+    return AsyncProgramManager::format("%s%s%s mrt %d%s", config.algorithm == ALGORITHM_HBAO_CHECKERBOARD ? "checkerboard" : "cache-aware",
+      config.specialBlur ? " specialblur" : "",
+      config.layered ? " layered" : "", getDeinterleaveMRT(deinterleave, config.deinterleaveMRT), precision);
+  }
+
+  std::string Sample::formatTuneConfig(const Tweak& config) const
+  {
+    return AsyncProgramManager::format("v%d %d %d %d %d %d %d", TUNE_FORMAT, int(config.algorithm), config.specialBlur, config.layered,
+      config.deinterleaveMRT, config.reducedPrecision, config.computeApron);
+  }
+
+  // only accepts setups getTuneCandidates can produce
+  bool Sample::parseTuneConfig(const std::string& value, Tweak& config) const
+  {
+    int format;
+    int algorithm;
+    int length = 0;
+    if (sscanf(value.c_str(), "v%d %d %d %d %d %d %d%n", &format, &algorithm, &config.specialBlur, &config.layered,
+          &config.deinterleaveMRT, &config.reducedPrecision, &config.computeApron, &length) != 7 ||
+        format != TUNE_FORMAT || value.c_str()[length] != 0)
     {
-      NV_PROFILE_SECTION("deinterleave");
-      glBindFramebuffer(GL_FRAMEBUFFER, fbos.hbao2_deinterleave);
-      glViewport(0,0,quarterWidth,quarterHeight);
+      return false;
+    }
+
+    if (algorithm != ALGORITHM_HBAO_CLASSIC && algorithm != ALGORITHM_HBAO_COMPUTE && algorithm != ALGORITHM_HBAO_CACHEAWARE){
+      return false;
+    }
+    config.algorithm = AlgorithmType(algorithm);
+
+    if ((config.specialBlur | config.layered | config.reducedPrecision) & ~1){
+      return false;
+    }
+
+    bool validMRT = false;
+    for (int mrt = 4; mrt <= MAX_MRT; mrt *= 2){
+      validMRT = validMRT || (config.deinterleaveMRT == mrt && getDeinterleaveMRT(deinterleave, mrt) == mrt);
+    }
+
+    bool validApron = false;
+    for (int i = 0; i < NUM_COMPUTE_APRONS; i++){
+      validApron = validApron || config.computeApron == COMPUTE_APRONS[i];
+    }
 
-      glUseProgram(progManager.get(programs.hbao2_deinterleave));
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, textures.scene_depthlinear);
+    // fields of the other algorithms are whatever tweak held while tuning
+    if (config.algorithm == ALGORITHM_HBAO_CACHEAWARE && !validMRT){
+      return false;
+    }
+    if (config.algorithm == ALGORITHM_HBAO_COMPUTE && !validApron){
+      return false;
+    }
+    if (!validMRT)    config.deinterleaveMRT = tweak.deinterleaveMRT;
+    if (!validApron)  config.computeApron    = tweak.computeApron;
 
-      for (int i = 0; i < HBAO_RANDOM_ELEMENTS; i+= NUM_MRT){
-        glUniform4f(0, float(i % 4) + 0.5f, float(i / 4) + 0.5f, hbaoUbo.InvFullResolution.x, hbaoUbo.InvFullResolution.y);
+    return true;
+  }
 
-        for (int layer = 0; layer < NUM_MRT; layer++){
-          glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + layer, textures.hbao2_depthview[i+layer], 0);
+  void Sample::getTuneCandidates(std::vector<Tweak>& candidates) const
+  {
+    // the first candidate is the reference: classic, full precision, with the
+    // blur using the linear depth instead of the one stored with the ao
+    Tweak config = tweak;
+    config.reducedPrecision = 0;
+    config.algorithm = ALGORITHM_HBAO_CLASSIC;
+    for (int special = 0; special < 2; special++){
+      config.specialBlur = special;
+      candidates.push_back(config);
+    }
+
+    config.algorithm = ALGORITHM_HBAO_COMPUTE;
+    for (int special = 0; special < 2; special++){
+      for (int i = 0; i < NUM_COMPUTE_APRONS; i++){
+        config.specialBlur = special;
+        config.computeApron = COMPUTE_APRONS[i];
+        candidates.push_back(config);
+      }
+    }
+    config.computeApron = tweak.computeApron;
+
+    config.algorithm = ALGORITHM_HBAO_CACHEAWARE;
+    for (int special = 0; special < 2; special++){
+      for (int layered = 0; layered < 2; layered++){
+        for (int mrt = 4; mrt <= MAX_MRT; mrt *= 2){
+          if (getDeinterleaveMRT(deinterleave, mrt) != mrt) continue;
+          config.specialBlur = special;
+          config.layered = layered;
+          config.deinterleaveMRT = mrt;
+          candidates.push_back(config);
         }
-        glDrawArrays(GL_TRIANGLES,0,3);
       }
     }
-    
-    {
-      NV_PROFILE_SECTION("ssaocalc");
 
-      glBindFramebuffer(GL_FRAMEBUFFER, fbos.hbao2_calc);
-      glViewport(0,0,quarterWidth,quarterHeight);
+    // every setup again with reduced precision
+    size_t numFull = candidates.size();
+    for (size_t i = 0; i < numFull; i++){
+      config = candidates[i];
+      config.reducedPrecision = 1;
+      candidates.push_back(config);
+    }
+  }
+
+  void Sample::applyTuneConfig(const Tweak& config)
+  {
+    tweak.algorithm       = config.algorithm;
+    tweak.specialBlur     = config.specialBlur;
+    tweak.layered         = config.layered;
+    tweak.deinterleaveMRT = config.deinterleaveMRT;
+    tweak.reducedPrecision = config.reducedPrecision;
+    tweak.computeApron    = config.computeApron;
+    tweakLast.algorithm       = tweak.algorithm;
+    tweakLast.specialBlur     = tweak.specialBlur;
+    tweakLast.layered         = tweak.layered;
+    tweakLast.deinterleaveMRT = tweak.deinterleaveMRT;
+    tweakLast.reducedPrecision = tweak.reducedPrecision;
+    tweakLast.computeApron    = tweak.computeApron;
+  }
 
-      glUseProgram(progManager.get(USE_AO_SPECIALBLUR && tweak.blur ? programs.hbao2_calc_blur : programs.hbao2_calc));
-      glBindMultiTextureEXT(GL_TEXTURE1, GL_TEXTURE_2D, textures.scene_viewnormal);
+  // returns milliseconds per frame of ao, ao holds the result on a white scene
+  float Sample::runTuneCandidate(const Projection& projection, GLuint readFbo, int width, int height, std::vector<unsigned char>& ao)
+  {
+    // the depth encoding depends on the candidate
+    prepareHbaoData(projection, width, height);
+    memcpy(frameSlots.getMapping(hbaoUboOffset), &hbaoUbo, sizeof(HBAOData));
 
-      glBindBufferBase(GL_UNIFORM_BUFFER,0,buffers.hbao_ubo);
-      glNamedBufferSubDataEXT(buffers.hbao_ubo,0,sizeof(HBAOData),&hbaoUbo);
+    // first runs include lazy driver work (e.g. shader recompiles)
+    for (int i = 0; i < TUNE_WARMUP; i++){
+      drawHbaoSamples(projection);
+    }
 
-#if USE_AO_LAYERED_SINGLEPASS
-      // instead of drawing to each layer individually
-      // we draw all layers at once, and use image writes to update the array texture
-      // this buys additional performance :)
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_deptharray);
-      glBindImageTexture( 0, textures.hbao2_resultarray, 0, GL_TRUE, 0, GL_WRITE_ONLY, USE_AO_SPECIALBLUR ? GL_RG16F : GL_R8);
-      glDrawArrays(GL_TRIANGLES,0,3 * HBAO_RANDOM_ELEMENTS);
-      glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-#else
-      for (int i = 0; i < HBAO_RANDOM_ELEMENTS; i++){
-        glUniform2f(0, float(i % 4) + 0.5f, float(i / 4) + 0.5f);
-        glUniform4fv(1, 1, hbaoRandom[i].get_value());
+    GLuint query;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    for (int i = 0; i < TUNE_RUNS; i++){
+      drawHbaoSamples(projection);
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+
+    GLuint64 time = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &time);
+    glDeleteQueries(1, &query);
+
+    // only the ao, msaa is resolved by the blit
+    float white[4] = {1.0f,1.0f,1.0f,1.0f};
+    glstate.bindFramebuffer(fbos.scene);
+    glClearBufferfv(GL_COLOR,0,white);
+    drawHbaoSamples(projection);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos.scene);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, readFbo);
+    glBlitFramebuffer(0,0,width,height,0,0,width,height,GL_COLOR_BUFFER_BIT,GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, readFbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0,0,width,height,GL_RED,GL_UNSIGNED_BYTE,&ao[0]);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glstate.invalidate();
 
-        glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, textures.hbao2_depthview[i]);
-        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textures.hbao2_resultarray, 0, i);
+    return float(double(time) / 1000000.0 / double(TUNE_RUNS));
+  }
 
-        glDrawArrays(GL_TRIANGLES,0,3);
+  void Sample::autoTune(const Projection& projection, int width, int height)
+  {
+    tuneKey = getTuneKey(width, height);
+
+    std::string value;
+    Tweak config = tweak;
+    if (!tweak.tune && tuningCache.find(tuneKey, value)){
+      if (parseTuneConfig(value, config)){
+        applyTuneConfig(config);
+        initAoFramebuffers(width, height);
+        printf("autotune: %s (stored)\n", getTuneName(tweak).c_str());
+        return;
       }
-#endif
+      printf("autotune: discarding stored \"%s\", outdated or invalid\n", value.c_str());
     }
+    tweak.tune = 0;
+    tweakLast.tune = 0;
 
-    {
-      NV_PROFILE_SECTION("reinterleave");
+    AoMeasure measure;
+    beginAoMeasure(measure, width, height);
 
-      if (tweak.blur){
-        glBindFramebuffer(GL_FRAMEBUFFER, fbos.hbao_calc);
-        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    std::vector<Tweak> candidates;
+    getTuneCandidates(candidates);
+
+    std::vector<unsigned char> reference(size_t(width) * size_t(height));
+    std::vector<unsigned char> ao(reference.size());
+
+    Tweak original = tweak;
+    int   best = -1;
+    float bestTime = 0;
+    for (size_t i = 0; i < candidates.size(); i++){
+      applyTuneConfig(candidates[i]);
+      initAoFramebuffers(width, height);
+
+      float time = runTuneCandidate(projection, measure.readFbo, width, height, i == 0 ? reference : ao);
+
+      // mean absolute difference of the ao term
+      float error = 0;
+      float maxError;
+      if (i != 0){
+        compareAo(ao, reference, error, maxError);
       }
-      else{
-        glBindFramebuffer(GL_FRAMEBUFFER, fbos.scene);
-        glDisable(GL_DEPTH_TEST);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_ZERO,GL_SRC_COLOR);
-        if (tweak.samples > 1){
-          glEnable(GL_SAMPLE_MASK);
-          glSampleMaski(0, 1<<sampleIdx);
-        }
+      bool valid = error <= tweak.tuneTolerance;
+
+      printf("autotune: %-48s %8.3f ms  error %.4f%s\n", getTuneName(candidates[i]).c_str(), time, error, valid ? "" : " (rejected)");
+
+      if (valid && (best < 0 || time < bestTime)){
+        best = int(i);
+        bestTime = time;
+      }
+    }
+
+    endAoMeasure(measure, width, height);
+
+    applyTuneConfig(best >= 0 ? candidates[best] : original);
+    initAoFramebuffers(width, height);
+
+    if (best >= 0){
+      value = formatTuneConfig(tweak);
+      if (!tuningCache.store(tuneKey, value)){
+        fprintf(stderr, "could not write auto-tune results\n");
       }
-      glViewport(0,0,width,height);
+      printf("autotune: %s\n", getTuneName(tweak).c_str());
+    }
+  }
+
 
-      glUseProgram(progManager.get(USE_AO_SPECIALBLUR && tweak.blur ? programs.hbao2_reinterleave_blur : programs.hbao2_reinterleave));
+  void Sample::beginAoMeasure(AoMeasure& measure, int width, int height)
+  {
+    measure.aoScale = aoScale;
+    aoScale = 1.0f;
 
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, textures.hbao2_resultarray);
-      glDrawArrays(GL_TRIANGLES,0,3);
-      glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, 0);
+    // the scene color is used for the ao only results, keep it
+    glGenTextures(1, &measure.backup);
+    glGenTextures(1, &measure.readTexture);
+    glGenFramebuffers(1, &measure.readFbo);
+    if (tweak.samples > 1){
+      glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, measure.backup);
+      glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, tweak.samples, GL_RGBA8, width, height, GL_FALSE);
+      glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
     }
+    else {
+      glBindTexture(GL_TEXTURE_2D, measure.backup);
+      glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+      glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    GLenum target = tweak.samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+    glCopyImageSubData(textures.scene_color, target, 0, 0, 0, 0, measure.backup, target, 0, 0, 0, 0, width, height, 1);
 
-    if (tweak.blur){
-      drawHbaoBlur(projection,width,height,sampleIdx);
+    glBindTexture(GL_TEXTURE_2D, measure.readTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, measure.readFbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, measure.readTexture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  // the caller re-creates the ao framebuffers for its final setup
+  void Sample::endAoMeasure(AoMeasure& measure, int width, int height)
+  {
+    GLenum target = tweak.samples > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+    glCopyImageSubData(measure.backup, target, 0, 0, 0, 0, textures.scene_color, target, 0, 0, 0, 0, width, height, 1);
+    glDeleteFramebuffers(1, &measure.readFbo);
+    glDeleteTextures(1, &measure.readTexture);
+    glDeleteTextures(1, &measure.backup);
+
+    aoScale = measure.aoScale;
+  }
+
+  void Sample::reportPrecision(const Projection& projection, int width, int height)
+  {
+    tweak.precisionReport = 0;
+    tweakLast.precisionReport = 0;
+
+    AoMeasure measure;
+    beginAoMeasure(measure, width, height);
+
+    std::vector<unsigned char> reference(size_t(width) * size_t(height));
+    std::vector<unsigned char> ao(reference.size());
+
+    Tweak original = tweak;
+    Tweak config = tweak;
+    float times[2];
+    for (int reduced = 0; reduced < 2; reduced++){
+      config.reducedPrecision = reduced;
+      applyTuneConfig(config);
+      initAoFramebuffers(width, height);
+
+      times[reduced] = runTuneCandidate(projection, measure.readFbo, width, height, reduced ? ao : reference);
     }
 
-    glDisable(GL_BLEND);
-    glEnable(GL_DEPTH_TEST);
-    glDisable(GL_SAMPLE_MASK);
-    glSampleMaski(0,~0);
+    endAoMeasure(measure, width, height);
 
-    glBindMultiTextureEXT(GL_TEXTURE0, GL_TEXTURE_2D, 0);
-    glBindMultiTextureEXT(GL_TEXTURE1, GL_TEXTURE_2D, 0);
+    applyTuneConfig(original);
+    initAoFramebuffers(width, height);
 
-    glUseProgram(0);
+    compareAo(ao, reference, precisionError, precisionMaxError);
 
+    printf("precision: %s\n", getTuneName(original).c_str());
+    printf("precision: full    %8.3f ms\n", times[0]);
+    printf("precision: reduced %8.3f ms  error mean %.4f max %.4f\n", times[1], precisionError, precisionMaxError);
+  }
 
+  void Sample::compareAo(const std::vector<unsigned char>& ao, const std::vector<unsigned char>& reference, float& mean, float& max)
+  {
+    double error = 0;
+    int    maxError = 0;
+    for (size_t p = 0; p < ao.size(); p++){
+      int diff = abs(int(ao[p]) - int(reference[p]));
+      error += diff;
+      maxError = std::max(maxError, diff);
+    }
+    mean = float(error / (double(ao.size()) * 255.0));
+    max  = float(maxError) / 255.0f;
   }
 
+  void Sample::benchmarkAlgorithms(const Projection& projection, int width, int height)
+  {
+    tweak.benchmark = 0;
+    tweakLast.benchmark = 0;
+
+    AoMeasure measure;
+    beginAoMeasure(measure, width, height);
+
+    std::vector<unsigned char> reference(size_t(width) * size_t(height));
+    std::vector<unsigned char> ao(reference.size());
+
+    // classic first, it is the reference
+    static const AlgorithmType algorithms[] = {ALGORITHM_HBAO_CLASSIC, ALGORITHM_HBAO_CACHEAWARE, ALGORITHM_HBAO_COMPUTE, ALGORITHM_HBAO_CHECKERBOARD};
+
+    Tweak original = tweak;
+    Tweak config = tweak;
+    for (int i = 0; i < int(sizeof(algorithms)/sizeof(algorithms[0])); i++){
+      config.algorithm = algorithms[i];
+      applyTuneConfig(config);
+      initAoFramebuffers(width, height);
+
+      prepareHbaoData(projection, width, height);
+      std::string name = getTuneName(tweak);
+      if (tweak.algorithm == ALGORITHM_HBAO_COMPUTE && !tweak.computeApron){
+        name += AsyncProgramManager::format(" (auto %d)", COMPUTE_APRONS[getComputeApronIdx()]);
+      }
+
+      float time = runTuneCandidate(projection, measure.readFbo, width, height, i == 0 ? reference : ao);
+
+      float error = 0;
+      float maxError = 0;
+      if (i != 0){
+        compareAo(ao, reference, error, maxError);
+      }
+      printf("benchmark: %-48s %8.3f ms  error mean %.4f max %.4f\n", name.c_str(), time, error, maxError);
+    }
+
+    endAoMeasure(measure, width, height);
+
+    applyTuneConfig(original);
+    initAoFramebuffers(width, height);
+  }
+
+  void Sample::tiledScreenshot(const Projection& projection, const mat4& view)
+  {
+    tweak.shot = 0;
+    tweakLast.shot = 0;
+    m_shot = false;
+
+    if (replayReader.isOpen()){
+      fprintf(stderr, "shot: not available during replay\n");
+      return;
+    }
+
+    int width   = framebufferWidth;
+    int height  = framebufferHeight;
+
+    int fullWidth   = m_shotWidth;
+    int fullHeight  = m_shotHeight;
+
+    // Every tile is rendered with a guard band that holds all taps of the
+    // pixels it outputs: the ao radius (limited to m_shotMaxRadius), the
+    // blur kernel (3 for the fragment blur), the normal reconstruction and
+    // the snapping of deinterleaved taps. Tiles start on the grid of the
+    // random texture and the deinterleaving, so the jitter pattern and the
+    // layer of every pixel are the same as in one large image.
+    int blurRadius = tweak.blur ? std::max(tweak.blurRadius, 3) : 0;
+    int guard = int(FrameSlots::alignedSize(size_t(m_shotMaxRadius + blurRadius + 1 + AO_RANDOMTEX_MAXSIZE), AO_RANDOMTEX_MAXSIZE));
+
+    GLint maxTexture = 0;
+    GLint maxViewport[2] = {0,0};
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTexture);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, maxViewport);
+    int maxSize = std::min(int(maxTexture), std::min(int(maxViewport[0]), int(maxViewport[1])));
+
+    int tile = int(FrameSlots::alignedSize(size_t(std::max(m_shotTile, AO_RANDOMTEX_MAXSIZE)), AO_RANDOMTEX_MAXSIZE));
+    tile = std::min(tile, (maxSize - 2 * guard) & ~(AO_RANDOMTEX_MAXSIZE - 1));
+    if (fullWidth <= 0 || fullHeight <= 0 || tile <= 0){
+      fprintf(stderr, "shot: invalid size %dx%d or guard band %d too large\n", fullWidth, fullHeight, guard);
+      return;
+    }
+    int renderSize = tile + 2 * guard;
+
+    TiledImageWriter writer;
+    if (!writer.open(m_shotFilename.c_str(), fullWidth, fullHeight)){
+      fprintf(stderr, "shot: could not create %s\n", m_shotFilename.c_str());
+      return;
+    }
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    // tiles are independent frames, no msaa, history or reduced ao resolution
+    Tweak original = tweak;
+    float originalScale = aoScale;
+    tweak.samples = 1;
+    if (tweak.algorithm == ALGORITHM_HBAO_CHECKERBOARD){
+      tweak.algorithm = ALGORITHM_HBAO_CACHEAWARE;
+    }
+    aoScale = 1.0f;
+    initFramebuffers(renderSize, renderSize, 1);
+
+    Projection full = projection;
+    full.update(fullWidth, fullHeight);
+    full.fullHeight       = fullHeight;
+    full.maxRadiusPixels  = float(m_shotMaxRadius);
+
+    std::vector<unsigned char> pixels(size_t(tile) * size_t(tile) * 3);
+
+    int tilesX = (fullWidth  + tile - 1) / tile;
+    int tilesY = (fullHeight + tile - 1) / tile;
+    bool ok = true;
+    for (int ty = 0; ty < tilesY && ok; ty++){
+      for (int tx = 0; tx < tilesX && ok; tx++){
+        int x = tx * tile;
+        int y = ty * tile;
+        int w = std::min(tile, fullWidth  - x);
+        int h = std::min(tile, fullHeight - y);
+
+        // off-center frustum of the rendered area, its center and half
+        // size in ndc of the full image are mapped to [-1,1]
+        float centerX = float(2 * (x - guard) + renderSize) / float(fullWidth)  - 1.0f;
+        float centerY = float(2 * (y - guard) + renderSize) / float(fullHeight) - 1.0f;
+        float halfX   = float(renderSize) / float(fullWidth);
+        float halfY   = float(renderSize) / float(fullHeight);
+
+        Projection part = full;
+        float* P = part.matrix.get_value();
+        P[4*0+0] = P[4*0+0] / halfX;
+        P[4*2+0] = (P[4*2+0] + centerX) / halfX;
+        P[4*1+1] = P[4*1+1] / halfY;
+        P[4*2+1] = (P[4*2+1] + centerY) / halfY;
+
+        glstate.viewport(0, 0, renderSize, renderSize);
+        glstate.bindFramebuffer(fbos.scene);
+        nv_math::vec4   bgColor(0.2,0.2,0.2,0.0);
+        glClearBufferfv(GL_COLOR,0,&bgColor.x);
+        drawScene(part, view, renderSize, renderSize);
+
+        prepareHbaoData(part, renderSize, renderSize);
+        memcpy(frameSlots.getMapping(hbaoUboOffset), &hbaoUbo, sizeof(HBAOData));
+        drawHbaoSamples(part);
+
+        // waits for the tile, so the next one can overwrite the uniforms
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos.scene);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(guard, guard, w, h, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glstate.invalidate();
+
+        ok = writer.writeRect(x, y, w, h, &pixels[0]);
+      }
+      printf("shot: row %d / %d\n", ty + 1, tilesY);
+    }
+    ok = writer.close() && ok;
+
+    tweak = original;
+    aoScale = originalScale;
+    initFramebuffers(width, height, tweak.samples);
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    if (ok){
+      printf("shot: %s, %dx%d in %d tiles of %d + %d guard, %.1f s\n",
+        m_shotFilename.c_str(), fullWidth, fullHeight, tilesX * tilesY, tile, guard, seconds);
+    }
+    else {
+      fprintf(stderr, "shot: could not write %s\n", m_shotFilename.c_str());
+    }
+  }
+
+  void Sample::drawScene(const Projection& projection, const mat4& view, int width, int height)
+  {
+    glClearDepth(1.0);
+    glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    glstate.countCall(2);
+    glstate.enable(GL_DEPTH_TEST);
+
+    sceneUbo.viewport = uvec2(width,height);
+
+    sceneUbo.viewProjMatrix = projection.matrix * view;
+    sceneUbo.viewMatrix = view;
+    sceneUbo.viewMatrixIT = nv_math::transpose(nv_math::invert(view));
+
+    glstate.useProgram(progManager.get(programs.draw_scene));
+    memcpy(frameSlots.getMapping(0), &sceneUbo, sizeof(SceneData));
+    glstate.countUpload(sizeof(SceneData));
+    glstate.bindUniformBuffer(UBO_SCENE, frameSlots.getBuffer(), frameSlots.getOffset(0), sizeof(SceneData));
+
+    glBindVertexBuffer(0,buffers.scene_vbo,0,sizeof(Vertex));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.scene_ibo);
+
+    glEnableVertexAttribArray(VERTEX_POS);
+    glEnableVertexAttribArray(VERTEX_NORMAL);
+    glEnableVertexAttribArray(VERTEX_COLOR);
+    glstate.countCall(5);
+
+    glstate.drawElements(GL_TRIANGLES, sceneTriangleIndices, GL_UNSIGNED_INT, NV_BUFFER_OFFSET(0));
+
+    glDisableVertexAttribArray(VERTEX_POS);
+    glDisableVertexAttribArray(VERTEX_NORMAL);
+    glDisableVertexAttribArray(VERTEX_COLOR);
+
+    glBindVertexBuffer(0,0,0,0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glstate.countCall(5);
+  }
 
   void Sample::think(double time)
   {
@@ -960,79 +2788,166 @@ namespace ssao
     if (m_window.onPress(KEY_R)){
       progManager.reloadPrograms();
     }
+    if (tweakLast.deinterleave != tweak.deinterleave || tweakLast.aoKernel != tweak.aoKernel){
+      updateProgramDefines();
+      progManager.reloadPrograms();
+    }
+
+    // programs are rebuilt in the background, until the new set is linked
+    // we keep rendering with the old one and the factor it was built with
+    bool deinterleaveChanged = false;
+    switch (progManager.update()){
+    case AsyncProgramManager::RELOAD_DONE:
+      deinterleaveChanged = deinterleave != definesDeinterleave;
+      deinterleave = definesDeinterleave;
+      aoKernel = definesKernel;
+      break;
+    case AsyncProgramManager::RELOAD_FAILED:
+      tweak.deinterleave = deinterleave;
+      tweakLast.deinterleave = deinterleave;
+      tweak.aoKernel = aoKernel;
+      tweakLast.aoKernel = aoKernel;
+      updateProgramDefines();
+      break;
+    default:
+      break;
+    }
+
     if (!progManager.areProgramsValid()){
       waitEvents();
       return;
     }
 
-    int width   = m_window.m_viewsize[0];
-    int height  = m_window.m_viewsize[1];
+    // waits only if the GPU has not yet finished the frame that used this slot
+    frameSlots.beginFrame(tweak.framesInFlight);
+
+    // hands finished readbacks to the consumer, never waits
+    readback.poll();
+
+    bool replay = replayReader.isOpen();
+    if (replay){
+      tweak.samples = 1;
+    }
+
+    // replay renders at the captured size and scales on the final blit
+    int width   = replay ? int(replayReader.getHeader().width)  : m_window.m_viewsize[0];
+    int height  = replay ? int(replayReader.getHeader().height) : m_window.m_viewsize[1];
 
     Projection projection;
-    projection.update(width,height);
+    nv_math::mat4 view = m_control.m_viewMatrix;
+
+    if (replay){
+      const CaptureFrame* frame = replayReader.getFrame(replayFrame);
+      projection.nearplane = frame->nearplane;
+      projection.farplane  = frame->farplane;
+      projection.fov       = frame->fov;
+      memcpy(projection.matrix.get_value(), frame->projection, sizeof(frame->projection));
+      memcpy(view.get_value(), frame->view, sizeof(frame->view));
+    }
+    else {
+      float sceneScale = sceneDimension / globalscale;
+      projection.nearplane *= sceneScale;
+      projection.farplane  *= sceneScale;
+      projection.update(width,height);
+    }
 
-    if (tweakLast.samples != tweak.samples){
+    {
+      vec4 focus = view * vec4(m_control.m_sceneOrbit, 1.0f);
+      focusDepth = -focus.z;
+    }
+
+    if (deinterleaveChanged){
+      initRandomTexture(deinterleave);
+    }
+
+    if (tweakLast.samples != tweak.samples || deinterleaveChanged ||
+        framebufferWidth != width || framebufferHeight != height)
+    {
       initFramebuffers(width,height,tweak.samples);
     }
+    else if (updateAoScale() ||
+      tweakLast.specialBlur != tweak.specialBlur || tweakLast.layered != tweak.layered ||
+      tweakLast.deinterleaveMRT != tweak.deinterleaveMRT || tweakLast.reducedPrecision != tweak.reducedPrecision ||
+      tweakLast.algorithm != tweak.algorithm || tweakLast.msaaMode != tweak.msaaMode)
+    {
+      // formats and attachments depend on the pipeline setup
+      initAoFramebuffers(width,height);
+    }
     tweakLast = tweak;
 
+    // resources may have been recreated above, start with unknown state
+    glstate.beginFrame();
+
+    if (tweak.shot){
+      tiledScreenshot(projection, view);
+    }
+
     {
       NV_PROFILE_SECTION("Scene");
-      glViewport(0, 0, width, height);
+      glstate.viewport(0, 0, width, height);
 
-      glBindFramebuffer(GL_FRAMEBUFFER, fbos.scene);
+      glstate.bindFramebuffer(fbos.scene);
 
       nv_math::vec4   bgColor(0.2,0.2,0.2,0.0);
       glClearBufferfv(GL_COLOR,0,&bgColor.x);
+      glstate.countCall();
 
-      glClearDepth(1.0);
-      glClear(GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-      glEnable(GL_DEPTH_TEST);
+      if (replay){
+        // no scene pass, the ssao pipeline is fed with the captured depth
+        glTextureSubImage2DEXT(textures.scene_depthstencil, GL_TEXTURE_2D, 0, 0, 0, width, height,
+          GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, replayReader.getDepth(replayFrame));
+        glstate.countCall();
+        glstate.countUpload(size_t(width) * size_t(height) * sizeof(uint));
 
-      sceneUbo.viewport = uvec2(width,height);
-     
-      nv_math::mat4 view = m_control.m_viewMatrix;
+        replayFrame = (replayFrame + 1) % replayReader.getNumFrames();
+        replayReader.prefetch(replayFrame);
+      }
+      else {
+        drawScene(projection, view, width, height);
 
-      sceneUbo.viewProjMatrix = projection.matrix * view;
-      sceneUbo.viewMatrix = view;
-      sceneUbo.viewMatrixIT = nv_math::transpose(nv_math::invert(view));
+        if (captureWriter.isOpen() && tweak.capture){
+          captureFrame(projection, view, width, height);
+        }
+      }
+    }
 
-      glUseProgram(progManager.get(programs.draw_scene));
-      glBindBufferBase(GL_UNIFORM_BUFFER, UBO_SCENE, buffers.scene_ubo);
-      glBufferSubData(GL_UNIFORM_BUFFER,0,sizeof(SceneData),&sceneUbo);
+    // with -autotune every gpu/driver/resolution is measured once, later runs use the stored result
+    if (tweak.tune || (m_autoTune && tuneKey != getTuneKey(width,height))){
+      autoTune(projection, width, height);
+    }
+    if (tweak.precisionReport){
+      reportPrecision(projection, width, height);
+    }
+    if (tweak.benchmark){
+      benchmarkAlgorithms(projection, width, height);
+    }
 
-      glBindVertexBuffer(0,buffers.scene_vbo,0,sizeof(Vertex));
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.scene_ibo);
+    {
+      NV_PROFILE_SECTION("ssao");
+      frameSlots.beginTimer(TIMER_SSAO);
 
-      glEnableVertexAttribArray(VERTEX_POS);
-      glEnableVertexAttribArray(VERTEX_NORMAL);
-      glEnableVertexAttribArray(VERTEX_COLOR);
+      // the ao passes run at aoWidth x aoHeight, the upsample pass
+      // applies the result at full resolution when they differ
 
-      glDrawElements(GL_TRIANGLES, sceneTriangleIndices, GL_UNSIGNED_INT, NV_BUFFER_OFFSET(0));
+      // same for all samples, written once per frame
+      prepareHbaoData(projection,aoWidth,aoHeight);
+      memcpy(frameSlots.getMapping(hbaoUboOffset), &hbaoUbo, sizeof(HBAOData));
+      glstate.countUpload(sizeof(HBAOData));
 
-      glDisableVertexAttribArray(VERTEX_POS);
-      glDisableVertexAttribArray(VERTEX_NORMAL);
-      glDisableVertexAttribArray(VERTEX_COLOR);
+      drawHbaoSamples(projection);
+      tweak.printGraph = 0;
+      tweakLast.printGraph = 0;
 
-      glBindBufferBase(GL_UNIFORM_BUFFER, UBO_SCENE, 0);
-      glBindVertexBuffer(0,0,0,0);
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+      glstate.viewport(0, 0, width, height);
+      frameSlots.endTimer(TIMER_SSAO);
     }
 
-    {
-      NV_PROFILE_SECTION("ssao");
-
-      for (int sample = 0; sample < tweak.samples; sample++)
-      {
-        switch(tweak.algorithm){
-        case ALGORITHM_HBAO_CLASSIC:
-          drawHbaoClassic(projection, width, height, sample);
-          break;
-        case ALGORITHM_HBAO_CACHEAWARE:
-          drawHbaoCacheAware(projection, width, height, sample);
-          break;
-        }
-      }
+    if (tweak.readback){
+      NV_PROFILE_SECTION("Readback");
+      readbackFrame(width, height);
+    }
+    else if (readback.isActive()){
+      readback.deinit();
     }
 
     {
@@ -1041,14 +2956,24 @@ namespace ssao
       glBindFramebuffer(GL_READ_FRAMEBUFFER, fbos.scene);
       glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
       glBlitFramebuffer(0,0,width,height,
-        0,0,width,height,GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        0,0,m_window.m_viewsize[0],m_window.m_viewsize[1],GL_COLOR_BUFFER_BIT, GL_NEAREST);
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
+      glstate.countCall(4);
     }
     
     {
       NV_PROFILE_SECTION("TwDraw");
       TwDraw();
     }
+
+    frameSlots.endFrame();
+
+    if (m_profilerPrint && time - countersPrintTime > 2.0){
+      const GLStateCache::Counters& counters = glstate.getCounters();
+      printf("Counters calls %5u; state %5u; redundant %5u; draws %4u; upload %8u bytes;\n",
+        counters.calls, counters.stateChanges, counters.redundant, counters.draws, counters.uploadBytes);
+      countersPrintTime = time;
+    }
   }
 
   void Sample::resize(int width, int height)
@@ -1063,6 +2988,60 @@ using namespace ssao;
 int sample_main(int argc, const char** argv)
 {
   Sample sample;
+
+  for (int i = 1; i < argc; i++){
+    if (strcmp(argv[i],"-capture") == 0 && i + 1 < argc){
+      sample.m_captureFilename = argv[++i];
+    }
+    else if (strcmp(argv[i],"-replay") == 0 && i + 1 < argc){
+      sample.m_replayFilename = argv[++i];
+    }
+    else if (strcmp(argv[i],"-autotune") == 0){
+      sample.m_autoTune = true;
+    }
+    else if (strcmp(argv[i],"-benchmark") == 0){
+      sample.m_benchmark = true;
+    }
+    else if (strcmp(argv[i],"-tiledshot") == 0 && i + 3 < argc){
+      sample.m_shot = true;
+      sample.m_shotWidth  = atoi(argv[++i]);
+      sample.m_shotHeight = atoi(argv[++i]);
+      sample.m_shotFilename = argv[++i];
+    }
+    else if (strcmp(argv[i],"-shottile") == 0 && i + 1 < argc){
+      sample.m_shotTile = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i],"-shotradius") == 0 && i + 1 < argc){
+      sample.m_shotMaxRadius = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i],"-readback") == 0){
+      sample.m_readback = true;
+    }
+    else if (strcmp(argv[i],"-readbackfile") == 0 && i + 1 < argc){
+      sample.m_readback = true;
+      sample.m_readbackFilename = argv[++i];
+    }
+    else if (strcmp(argv[i],"-readbackshm") == 0 && i + 1 < argc){
+      sample.m_readback = true;
+      sample.m_readbackShmName = argv[++i];
+    }
+    else if (strcmp(argv[i],"-readbackslots") == 0 && i + 1 < argc){
+      sample.m_readbackSlots = std::max(1, atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i],"-scene") == 0 && i + 1 < argc){
+      sample.m_sceneFilename = argv[++i];
+    }
+    else if (strcmp(argv[i],"-sceneobjects") == 0 && i + 1 < argc){
+      sample.m_sceneObjects = uint(atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i],"-scenelevels") == 0 && i + 1 < argc){
+      sample.m_sceneLevels = uint(atoi(argv[++i]));
+    }
+    else if (strcmp(argv[i],"-scenethreads") == 0 && i + 1 < argc){
+      sample.m_sceneThreads = uint(atoi(argv[++i]));
+    }
+  }
+
   return sample.run(
     PROJECT_NAME,
     argc, argv,
@@ -0,0 +1,877 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+// Offline HBAO baker
+//
+// Runs the same HBAO algorithms as the sample (hbao.frag.glsl, hbao_blur.frag.glsl)
+// on the cpu for sequences of depth images. Frames are streamed through a bounded
+// pipeline: the main thread maps input files, a work-stealing pool runs
+// the ao and blur stages of several frames concurrently, a writer thread
+// stores the results. At most "-inflight" frames exist at any time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nv_math/nv_math_glsltypes.h>
+#include <noise/MersenneTwister.h>
+
+using namespace nv_math;
+#include "../common.h"
+#include "../mappedfile.hpp"
+#include "../workpool.hpp"
+
+namespace aobaker
+{
+  using ssao::HBAOData;
+
+  static const int  HBAO_RANDOM_MAXSIZE = AO_RANDOMTEX_MAXSIZE;
+  static const int  HBAO_RANDOM_MAXELEMENTS = HBAO_RANDOM_MAXSIZE*HBAO_RANDOM_MAXSIZE;
+
+  // keep in sync with hbao.frag.glsl / hbao_blur.frag.glsl
+  static const int  NUM_STEPS = 4;
+  static const int  NUM_DIRECTIONS = 8;
+  static const int  KERNEL_RADIUS = 3;
+
+  static const float HBAO_PI = 3.14159265f;
+
+  enum AlgorithmType {
+    ALGORITHM_HBAO_CACHEAWARE,
+    ALGORITHM_HBAO_CLASSIC,
+  };
+
+  struct Config {
+    Config()
+      : algorithm(ALGORITHM_HBAO_CACHEAWARE)
+      , factor(AO_RANDOMTEX_SIZE)
+      , fx(0), fy(0), cx(0), cy(0)
+      , windowDepth(false)
+      , nearplane(0.1f)
+      , farplane(100.0f)
+      , intensity(1.5f)
+      , radius(2.0f)
+      , bias(0.1f)
+      , blur(true)
+      , blurSharpness(40.0f)
+      , rawWidth(0)
+      , rawHeight(0)
+      , threads(0)
+      , inflight(0)
+      , outdir(".")
+    {}
+
+    AlgorithmType algorithm;
+    int           factor;
+    float         fx, fy, cx, cy;
+    bool          windowDepth;
+    float         nearplane;
+    float         farplane;
+    float         intensity;
+    float         radius;
+    float         bias;
+    bool          blur;
+    float         blurSharpness;
+    int           rawWidth;
+    int           rawHeight;
+    unsigned int  threads;
+    unsigned int  inflight;
+    std::string   outdir;
+  };
+
+  struct float3 {
+    float x, y, z;
+
+    float3() {}
+    float3(float a, float b, float c) : x(a), y(b), z(c) {}
+
+    float3 operator+(const float3& o) const { return float3(x+o.x, y+o.y, z+o.z); }
+    float3 operator-(const float3& o) const { return float3(x-o.x, y-o.y, z-o.z); }
+    float3 operator-() const { return float3(-x, -y, -z); }
+  };
+
+  inline float dot(const float3& a, const float3& b)
+  {
+    return a.x*b.x + a.y*b.y + a.z*b.z;
+  }
+
+  inline float3 cross(const float3& a, const float3& b)
+  {
+    return float3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+  }
+
+  inline float3 normalize(const float3& a)
+  {
+    float len = sqrtf(dot(a,a));
+    return len > 0 ? float3(a.x/len, a.y/len, a.z/len) : a;
+  }
+
+  inline float saturate(float v)
+  {
+    return std::min(std::max(v, 0.0f), 1.0f);
+  }
+
+  inline int clampi(int v, int lo, int hi)
+  {
+    return std::min(std::max(v, lo), hi);
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // single channel float image, rows bottom-up like GL textures
+
+  struct Image {
+    const float*  data;
+    int           width;
+    int           height;
+
+    // GL_NEAREST + GL_CLAMP_TO_EDGE
+    float fetch(float u, float v) const
+    {
+      int x = clampi(int(floorf(u * float(width))),  0, width-1);
+      int y = clampi(int(floorf(v * float(height))), 0, height-1);
+      return data[size_t(y) * width + x];
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+  // cpu port of hbao.frag.glsl
+
+  class HbaoKernel {
+  public:
+    HbaoKernel(const HBAOData& control) : m_control(control) {}
+
+    float3 UVToView(float u, float v, float eye_z) const
+    {
+      float scale = m_control.projOrtho != 0 ? 1.0f : eye_z;
+      return float3((u * m_control.projInfo.x + m_control.projInfo.z) * scale,
+                    (v * m_control.projInfo.y + m_control.projInfo.w) * scale,
+                    eye_z);
+    }
+
+    float3 FetchViewPos(const Image& tex, float u, float v) const
+    {
+      return UVToView(u, v, tex.fetch(u,v));
+    }
+
+    static float3 MinDiff(const float3& P, const float3& Pr, const float3& Pl)
+    {
+      float3 V1 = Pr - P;
+      float3 V2 = P - Pl;
+      return (dot(V1,V1) < dot(V2,V2)) ? V1 : V2;
+    }
+
+    float3 ReconstructNormal(const Image& tex, float u, float v, const float3& P) const
+    {
+      float3 Pr = FetchViewPos(tex, u + m_control.InvFullResolution.x, v);
+      float3 Pl = FetchViewPos(tex, u - m_control.InvFullResolution.x, v);
+      float3 Pt = FetchViewPos(tex, u, v + m_control.InvFullResolution.y);
+      float3 Pb = FetchViewPos(tex, u, v - m_control.InvFullResolution.y);
+      return normalize(cross(MinDiff(P, Pr, Pl), MinDiff(P, Pt, Pb)));
+    }
+
+    float ComputeAO(const float3& P, const float3& N, const float3& S) const
+    {
+      float3 V = S - P;
+      float VdotV = dot(V, V);
+      float NdotV = dot(N, V) * 1.0f/sqrtf(VdotV);
+
+      return saturate(NdotV - m_control.NDotVBias) * saturate(VdotV * m_control.NegInvR2 + 1.0f);
+    }
+
+    // tex is either the full resolution depth or one deinterleaved layer,
+    // invResolution and radiusPixels must match
+    float ComputeCoarseAO(const Image& tex, float invResX, float invResY, float u, float v,
+                          float RadiusPixels, const vec4& Rand, const float3& ViewPosition, const float3& ViewNormal) const
+    {
+      float StepSizePixels = RadiusPixels / (NUM_STEPS + 1);
+
+      const float Alpha = 2.0f * HBAO_PI / NUM_DIRECTIONS;
+      float AO = 0;
+
+      for (int DirectionIndex = 0; DirectionIndex < NUM_DIRECTIONS; ++DirectionIndex)
+      {
+        float Angle = Alpha * float(DirectionIndex);
+
+        float dx = cosf(Angle);
+        float dy = sinf(Angle);
+        float Dirx = dx*Rand.x - dy*Rand.y;
+        float Diry = dx*Rand.y + dy*Rand.x;
+
+        float RayPixels = (Rand.z * StepSizePixels + 1.0f);
+
+        for (int StepIndex = 0; StepIndex < NUM_STEPS; ++StepIndex)
+        {
+          float su = floorf(RayPixels * Dirx + 0.5f) * invResX + u;
+          float sv = floorf(RayPixels * Diry + 0.5f) * invResY + v;
+          float3 S = FetchViewPos(tex, su, sv);
+
+          RayPixels += StepSizePixels;
+
+          AO += ComputeAO(ViewPosition, ViewNormal, S);
+        }
+      }
+
+      AO *= m_control.AOMultiplier / (NUM_DIRECTIONS * NUM_STEPS);
+      return saturate(1.0f - AO * 2.0f);
+    }
+
+    float RadiusPixels(const float3& P) const
+    {
+      return std::min(m_control.RadiusToScreen / (m_control.projOrtho != 0 ? 1.0f : P.z), m_control.MaxRadiusPixels);
+    }
+
+    float Output(float AO) const
+    {
+      return powf(AO, m_control.PowExponent);
+    }
+
+  private:
+    const HBAOData& m_control;
+  };
+
+  //////////////////////////////////////////////////////////////////////////
+
+  void prepareHbaoData(HBAOData& hbao, const Config& cfg, int width, int height, const vec4f* random)
+  {
+    // pinhole in pixels, origin at the bottom-left corner like GL window coordinates
+    hbao.projOrtho = 0;
+    hbao.projInfo  = vec4(float(width)/cfg.fx, float(height)/cfg.fy, -cfg.cx/cfg.fx, -cfg.cy/cfg.fy);
+
+    float projScale = cfg.fy;
+
+    float R = cfg.radius;
+    hbao.R2 = R * R;
+    hbao.NegInvR2 = -1.0f / hbao.R2;
+    hbao.RadiusToScreen = R * 0.5f * projScale;
+
+    hbao.PowExponent = std::max(cfg.intensity,0.0f);
+    hbao.NDotVBias = std::min(std::max(0.0f, cfg.bias),1.0f);
+    hbao.AOMultiplier = 1.0f / (1.0f - hbao.NDotVBias);
+    hbao.DepthPackScale = 1.0f;
+    hbao.MaxRadiusPixels = 1e30f;
+
+    int factor = cfg.factor;
+    int quarterWidth  = ((width+factor-1)/factor);
+    int quarterHeight = ((height+factor-1)/factor);
+
+    hbao.InvQuarterResolution = vec2(1.0f/float(quarterWidth),1.0f/float(quarterHeight));
+    hbao.InvFullResolution = vec2(1.0f/float(width),1.0f/float(height));
+
+    for (int i = 0; i < factor*factor; i++){
+      hbao.float2Offsets[i] = vec4(float(i % factor) + 0.5f, float(i / factor) + 0.5f, 0, 0);
+      hbao.jitters[i] = random[i];
+    }
+  }
+
+  // same sequence as Sample::initMisc, so results match the sample's first msaa sample
+  void initRandom(vec4f* random)
+  {
+    MTRand rng;
+    rng.seed((unsigned)0);
+
+    for (int i = 0; i < HBAO_RANDOM_MAXELEMENTS; i++){
+      float Rand1 = float(rng.randExc());
+      float Rand2 = float(rng.randExc());
+
+      float Angle = 2.f * HBAO_PI * Rand1 / float(NUM_DIRECTIONS);
+      random[i] = vec4(cosf(Angle), sinf(Angle), Rand2, 0);
+    }
+  }
+
+  // output is interleaved (ao, viewdepth) like the AO_BLUR shader variants
+  void computeHbaoClassic(const HBAOData& control, int factor, const Image& depth, float* output)
+  {
+    HbaoKernel kernel(control);
+    int width  = depth.width;
+    int height = depth.height;
+
+    for (int y = 0; y < height; y++){
+      for (int x = 0; x < width; x++){
+        float u = (float(x) + 0.5f) * control.InvFullResolution.x;
+        float v = (float(y) + 0.5f) * control.InvFullResolution.y;
+
+        float3 ViewPosition = kernel.FetchViewPos(depth, u, v);
+        float3 ViewNormal   = -kernel.ReconstructNormal(depth, u, v, ViewPosition);
+        const vec4& Rand    = control.jitters[(y % factor) * factor + (x % factor)];
+
+        float AO = kernel.ComputeCoarseAO(depth, control.InvFullResolution.x, control.InvFullResolution.y, u, v,
+                                          kernel.RadiusPixels(ViewPosition), Rand, ViewPosition, ViewNormal);
+
+        size_t idx = size_t(y) * width + x;
+        output[idx*2+0] = kernel.Output(AO);
+        output[idx*2+1] = ViewPosition.z;
+      }
+    }
+  }
+
+  void computeHbaoCacheAware(const HBAOData& control, int factor, const Image& depth, float* output)
+  {
+    HbaoKernel kernel(control);
+    int width  = depth.width;
+    int height = depth.height;
+    int quarterWidth  = ((width+factor-1)/factor);
+    int quarterHeight = ((height+factor-1)/factor);
+
+    // viewnormal pass
+    std::vector<float3> normals(size_t(width) * height);
+    for (int y = 0; y < height; y++){
+      for (int x = 0; x < width; x++){
+        float u = (float(x) + 0.5f) * control.InvFullResolution.x;
+        float v = (float(y) + 0.5f) * control.InvFullResolution.y;
+        float3 P = kernel.FetchViewPos(depth, u, v);
+        normals[size_t(y) * width + x] = kernel.ReconstructNormal(depth, u, v, P);
+      }
+    }
+
+    // one layer at a time, so the working set stays small
+    std::vector<float> layerDepth(size_t(quarterWidth) * quarterHeight);
+    Image layer = { &layerDepth[0], quarterWidth, quarterHeight };
+
+    for (int i = 0; i < factor*factor; i++){
+      int offsetX = i % factor;
+      int offsetY = i / factor;
+
+      // deinterleave
+      for (int y = 0; y < quarterHeight; y++){
+        int fullY = clampi(y * factor + offsetY, 0, height-1);
+        for (int x = 0; x < quarterWidth; x++){
+          int fullX = clampi(x * factor + offsetX, 0, width-1);
+          layerDepth[size_t(y) * quarterWidth + x] = depth.data[size_t(fullY) * width + fullX];
+        }
+      }
+
+      // calc & reinterleave
+      const vec4& Rand = control.jitters[i];
+      for (int y = 0; y < quarterHeight; y++){
+        int fullY = y * factor + offsetY;
+        if (fullY >= height) break;
+
+        for (int x = 0; x < quarterWidth; x++){
+          int fullX = x * factor + offsetX;
+          if (fullX >= width) break;
+
+          float u = (float(fullX) + 0.5f) * control.InvQuarterResolution.x / float(factor);
+          float v = (float(fullY) + 0.5f) * control.InvQuarterResolution.y / float(factor);
+
+          size_t idx = size_t(fullY) * width + fullX;
+          float3 ViewPosition = kernel.FetchViewPos(layer, u, v);
+          float3 ViewNormal   = -normals[idx];
+
+          float AO = kernel.ComputeCoarseAO(layer, control.InvQuarterResolution.x, control.InvQuarterResolution.y, u, v,
+                                            kernel.RadiusPixels(ViewPosition) / float(factor), Rand, ViewPosition, ViewNormal);
+
+          output[idx*2+0] = kernel.Output(AO);
+          output[idx*2+1] = ViewPosition.z;
+        }
+      }
+    }
+  }
+
+  // cpu port of hbao_blur.frag.glsl, one direction
+  void blurPass(const float* input, float* output, int width, int height, int dirX, int dirY, float sharpness, bool present)
+  {
+    const float BlurSigma = float(KERNEL_RADIUS) * 0.5f;
+    const float BlurFalloff = 1.0f / (2.0f*BlurSigma*BlurSigma);
+
+    for (int y = 0; y < height; y++){
+      for (int x = 0; x < width; x++){
+        size_t idx = size_t(y) * width + x;
+        float center_c = input[idx*2+0];
+        float center_d = input[idx*2+1];
+
+        float c_total = center_c;
+        float w_total = 1.0f;
+
+        for (int r = -KERNEL_RADIUS; r <= KERNEL_RADIUS; r++){
+          if (r == 0) continue;
+          int sx = clampi(x + dirX * r, 0, width-1);
+          int sy = clampi(y + dirY * r, 0, height-1);
+          size_t sidx = size_t(sy) * width + sx;
+
+          float ddiff = (input[sidx*2+1] - center_d) * sharpness;
+          float w = exp2f(-float(r*r)*BlurFalloff - ddiff*ddiff);
+          w_total += w;
+          c_total += input[sidx*2+0] * w;
+        }
+
+        if (present){
+          output[idx] = c_total/w_total;
+        }
+        else{
+          output[idx*2+0] = c_total/w_total;
+          output[idx*2+1] = center_d;
+        }
+      }
+    }
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // depth image i/o
+
+  static bool isLittleEndian()
+  {
+    unsigned int value = 1;
+    return *(unsigned char*)&value == 1;
+  }
+
+  static std::string getExtension(const std::string& filename)
+  {
+    size_t dot = filename.find_last_of('.');
+    size_t sep = filename.find_last_of("/\\");
+    if (dot == std::string::npos || (sep != std::string::npos && dot < sep)) return std::string();
+    std::string ext = filename.substr(dot);
+    for (size_t i = 0; i < ext.size(); i++) ext[i] = char(tolower(ext[i]));
+    return ext;
+  }
+
+  static std::string getStem(const std::string& filename)
+  {
+    size_t sep = filename.find_last_of("/\\");
+    std::string name = sep == std::string::npos ? filename : filename.substr(sep+1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0,dot);
+  }
+
+  struct Frame {
+    std::string         inputName;
+    std::string         outputName;
+    bool                pfm;
+
+    MappedFile          file;
+    const char*         pixels;     // first texel within the mapping
+    bool                swap;       // big endian pfm on little endian host or vice versa
+    Image               depth;
+    std::vector<float>  depthCopy;  // only used if mapped data can't be used directly
+
+    std::vector<float>  ao;         // (ao, depth) pairs
+    std::vector<float>  blurred;
+    std::vector<float>  result;
+  };
+
+  // parses "Pf" headers only, texels are not touched here
+  static bool openPFM(Frame& frame)
+  {
+    const char* base = (const char*)frame.file.data();
+    size_t size = frame.file.size();
+
+    char magic[3] = {0};
+    int width = 0;
+    int height = 0;
+    float scale = 0;
+    int headerSize = 0;
+
+    // header is three text lines, the last one ends with a single whitespace
+    std::string header(base, std::min(size, size_t(256)));
+    if (sscanf(header.c_str(), "%2s %d %d %f%n", magic, &width, &height, &scale, &headerSize) != 4 || headerSize <= 0){
+      return false;
+    }
+    headerSize++;
+
+    if (strcmp(magic,"PF") == 0){
+      fprintf(stderr, "aobaker: %s is a three channel PF image, depth must be single channel Pf\n", frame.inputName.c_str());
+      return false;
+    }
+    if (strcmp(magic,"Pf") != 0 || width <= 0 || height <= 0 || scale == 0){
+      return false;
+    }
+
+    size_t texels = size_t(width) * height;
+    if (size_t(headerSize) + texels * sizeof(float) > size){
+      return false;
+    }
+
+    frame.pixels       = base + headerSize;
+    frame.swap         = (scale < 0) != isLittleEndian();
+    frame.depth.width  = width;
+    frame.depth.height = height;
+    return true;
+  }
+
+  static bool openRAW(Frame& frame, const Config& cfg)
+  {
+    size_t texels = size_t(cfg.rawWidth) * cfg.rawHeight;
+    if (!texels || frame.file.size() < texels * sizeof(float)){
+      return false;
+    }
+
+    frame.pixels       = (const char*)frame.file.data();
+    frame.swap         = false;
+    frame.depth.width  = cfg.rawWidth;
+    frame.depth.height = cfg.rawHeight;
+    return true;
+  }
+
+  // runs on the submitting thread, so only maps and validates the file
+  static bool openFrame(Frame& frame, const Config& cfg)
+  {
+    if (!frame.file.open(frame.inputName.c_str())){
+      return false;
+    }
+
+    bool valid = frame.pfm ? openPFM(frame) : openRAW(frame,cfg);
+    if (!valid){
+      return false;
+    }
+
+    // kick off reading while the frame waits for a worker
+    frame.file.prefetch(0, frame.file.size());
+    return true;
+  }
+
+  // runs on a worker, uses the mapping in place or converts it into depthCopy
+  static void loadDepth(Frame& frame, const Config& cfg)
+  {
+    size_t texels = size_t(frame.depth.width) * frame.depth.height;
+
+    if (!frame.swap && !cfg.windowDepth && (size_t(frame.pixels) % sizeof(float)) == 0){
+      frame.depth.data = (const float*)frame.pixels;
+      return;
+    }
+
+    // same as depthlinearize.frag.glsl for perspective projections
+    float clipA = cfg.nearplane * cfg.farplane;
+    float clipB = cfg.nearplane - cfg.farplane;
+    float clipC = cfg.farplane;
+
+    frame.depthCopy.resize(texels);
+    for (size_t i = 0; i < texels; i++){
+      unsigned char bytes[4];
+      memcpy(bytes, frame.pixels + i * sizeof(float), sizeof(float));
+      if (frame.swap){
+        std::swap(bytes[0],bytes[3]);
+        std::swap(bytes[1],bytes[2]);
+      }
+      float value;
+      memcpy(&value, bytes, sizeof(float));
+      frame.depthCopy[i] = cfg.windowDepth ? clipA / (clipB * value + clipC) : value;
+    }
+    frame.depth.data = &frame.depthCopy[0];
+  }
+
+  static bool writeFrame(const Frame& frame)
+  {
+    FILE* file = fopen(frame.outputName.c_str(), "wb");
+    if (!file){
+      return false;
+    }
+
+    if (frame.pfm){
+      fprintf(file, "Pf\n%d %d\n%s\n", frame.depth.width, frame.depth.height, isLittleEndian() ? "-1.0" : "1.0");
+    }
+
+    size_t texels = frame.result.size();
+    bool valid = fwrite(&frame.result[0], sizeof(float), texels, file) == texels;
+    fclose(file);
+    return valid;
+  }
+
+  //////////////////////////////////////////////////////////////////////////
+  // pipeline
+
+  class Semaphore {
+  public:
+    explicit Semaphore(unsigned int count) : m_count(count) {}
+
+    void acquire()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this]{ return m_count > 0; });
+      m_count--;
+    }
+
+    void release()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_count++;
+      }
+      m_cond.notify_one();
+    }
+
+  private:
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    unsigned int            m_count;
+  };
+
+  class FrameQueue {
+  public:
+    FrameQueue() : m_closed(false) {}
+
+    void push(Frame* frame)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_frames.push_back(frame);
+      }
+      m_cond.notify_one();
+    }
+
+    void close()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+      }
+      m_cond.notify_all();
+    }
+
+    // returns NULL once closed and drained
+    Frame* pop()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this]{ return m_closed || !m_frames.empty(); });
+      if (m_frames.empty()) return NULL;
+      Frame* frame = m_frames.front();
+      m_frames.pop_front();
+      return frame;
+    }
+
+  private:
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    std::deque<Frame*>      m_frames;
+    bool                    m_closed;
+  };
+
+  class Baker {
+  public:
+    Baker(const Config& cfg)
+      : m_cfg(cfg)
+      , m_pool(cfg.threads)
+      , m_inflight(cfg.inflight ? cfg.inflight : m_pool.getNumThreads() * 2)
+      , m_failed(0)
+    {
+      initRandom(m_random);
+    }
+
+    int run(const std::vector<std::string>& inputs)
+    {
+      std::thread writer(&Baker::writeFrames, this);
+
+      for (size_t i = 0; i < inputs.size(); i++){
+        m_inflight.acquire();
+
+        Frame* frame = new Frame;
+        frame->inputName  = inputs[i];
+        frame->pfm        = getExtension(inputs[i]) == ".pfm";
+        frame->outputName = m_cfg.outdir + "/" + getStem(inputs[i]) + "_ao" + (frame->pfm ? ".pfm" : ".raw");
+
+        if (!openFrame(*frame, m_cfg)){
+          fprintf(stderr, "aobaker: could not read %s\n", frame->inputName.c_str());
+          m_failed++;
+          delete frame;
+          m_inflight.release();
+          continue;
+        }
+
+        m_pool.push([this, frame]{ computeStage(frame); });
+      }
+
+      m_pool.wait();
+      m_queue.close();
+      writer.join();
+
+      return m_failed;
+    }
+
+  private:
+    void computeStage(Frame* frame)
+    {
+      loadDepth(*frame, m_cfg);
+
+      const Image& depth = frame->depth;
+      size_t texels = size_t(depth.width) * depth.height;
+
+      HBAOData control;
+      prepareHbaoData(control, m_cfg, depth.width, depth.height, m_random);
+
+      frame->ao.resize(texels * 2);
+      if (m_cfg.algorithm == ALGORITHM_HBAO_CLASSIC){
+        computeHbaoClassic(control, m_cfg.factor, depth, &frame->ao[0]);
+      }
+      else {
+        computeHbaoCacheAware(control, m_cfg.factor, depth, &frame->ao[0]);
+      }
+
+      // input no longer needed, release the mapping early
+      frame->file.close();
+      std::vector<float>().swap(frame->depthCopy);
+
+      if (m_cfg.blur){
+        // lands on this worker's deque, runs next while the data is hot
+        m_pool.push([this, frame]{ blurStage(frame); });
+      }
+      else {
+        frame->result.resize(texels);
+        for (size_t i = 0; i < texels; i++){
+          frame->result[i] = frame->ao[i*2];
+        }
+        std::vector<float>().swap(frame->ao);
+        m_queue.push(frame);
+      }
+    }
+
+    void blurStage(Frame* frame)
+    {
+      int width  = frame->depth.width;
+      int height = frame->depth.height;
+      size_t texels = size_t(width) * height;
+
+      frame->blurred.resize(texels * 2);
+      frame->result.resize(texels);
+      blurPass(&frame->ao[0],      &frame->blurred[0], width, height, 1, 0, m_cfg.blurSharpness, false);
+      blurPass(&frame->blurred[0], &frame->result[0],  width, height, 0, 1, m_cfg.blurSharpness, true);
+
+      std::vector<float>().swap(frame->ao);
+      std::vector<float>().swap(frame->blurred);
+      m_queue.push(frame);
+    }
+
+    void writeFrames()
+    {
+      while (Frame* frame = m_queue.pop()){
+        if (!writeFrame(*frame)){
+          fprintf(stderr, "aobaker: could not write %s\n", frame->outputName.c_str());
+          m_failed++;
+        }
+        delete frame;
+        m_inflight.release();
+      }
+    }
+
+    const Config&     m_cfg;
+    WorkPool          m_pool;
+    Semaphore         m_inflight;
+    FrameQueue        m_queue;
+    std::atomic<int>  m_failed;
+    vec4f             m_random[HBAO_RANDOM_MAXELEMENTS];
+  };
+
+  static void printUsage()
+  {
+    fprintf(stderr,
+      "usage: aobaker [options] depth0.pfm [depth1.pfm ...]\n"
+      "  inputs are single channel .pfm (Pf) or .raw float32 images, rows bottom-up\n"
+      "  -intrinsics fx fy cx cy  pinhole camera in pixels, origin bottom-left (required)\n"
+      "  -size w h                dimension of .raw inputs\n"
+      "  -windowdepth near far    inputs are [0,1] perspective depth instead of linear view depth\n"
+      "  -algorithm name          cacheaware (default) or classic\n"
+      "  -deinterleave n          random tiling / deinterleave grid: 2, 4 (default) or 8\n"
+      "  -radius r                world-space radius (2.0)\n"
+      "  -intensity i             (1.5)\n"
+      "  -bias b                  (0.1)\n"
+      "  -noblur                  skip the bilateral blur\n"
+      "  -sharpness s             blur sharpness (40.0)\n"
+      "  -threads n               worker threads (all cores)\n"
+      "  -inflight n              max frames in the pipeline (2 x threads)\n"
+      "  -out dir                 output directory (.)\n");
+  }
+}
+
+using namespace aobaker;
+
+int main(int argc, const char** argv)
+{
+  Config cfg;
+  std::vector<std::string> inputs;
+
+  for (int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    int left = argc - i - 1;
+
+    if (arg == "-intrinsics" && left >= 4){
+      cfg.fx = float(atof(argv[++i]));
+      cfg.fy = float(atof(argv[++i]));
+      cfg.cx = float(atof(argv[++i]));
+      cfg.cy = float(atof(argv[++i]));
+    }
+    else if (arg == "-size" && left >= 2){
+      cfg.rawWidth  = atoi(argv[++i]);
+      cfg.rawHeight = atoi(argv[++i]);
+    }
+    else if (arg == "-windowdepth" && left >= 2){
+      cfg.windowDepth = true;
+      cfg.nearplane = float(atof(argv[++i]));
+      cfg.farplane  = float(atof(argv[++i]));
+    }
+    else if (arg == "-algorithm" && left >= 1){
+      std::string name = argv[++i];
+      if (name == "classic")          cfg.algorithm = ALGORITHM_HBAO_CLASSIC;
+      else if (name == "cacheaware")  cfg.algorithm = ALGORITHM_HBAO_CACHEAWARE;
+      else {
+        printUsage();
+        return 1;
+      }
+    }
+    else if (arg == "-deinterleave" && left >= 1){
+      cfg.factor = atoi(argv[++i]);
+      if (cfg.factor != 2 && cfg.factor != 4 && cfg.factor != 8){
+        printUsage();
+        return 1;
+      }
+    }
+    else if (arg == "-radius" && left >= 1)     cfg.radius = float(atof(argv[++i]));
+    else if (arg == "-intensity" && left >= 1)  cfg.intensity = float(atof(argv[++i]));
+    else if (arg == "-bias" && left >= 1)       cfg.bias = float(atof(argv[++i]));
+    else if (arg == "-noblur")                  cfg.blur = false;
+    else if (arg == "-sharpness" && left >= 1)  cfg.blurSharpness = float(atof(argv[++i]));
+    else if (arg == "-threads" && left >= 1)    cfg.threads = unsigned(atoi(argv[++i]));
+    else if (arg == "-inflight" && left >= 1)   cfg.inflight = unsigned(atoi(argv[++i]));
+    else if (arg == "-out" && left >= 1)        cfg.outdir = argv[++i];
+    else if (arg[0] == '-'){
+      printUsage();
+      return 1;
+    }
+    else {
+      inputs.push_back(arg);
+    }
+  }
+
+  if (inputs.empty() || cfg.fx <= 0 || cfg.fy <= 0){
+    printUsage();
+    return 1;
+  }
+
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+  Baker baker(cfg);
+  int failed = baker.run(inputs);
+
+  double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  printf("aobaker: %d frames in %.2f s (%.1f fps)\n", int(inputs.size()) - failed, seconds, double(inputs.size() - failed) / seconds);
+
+  return failed ? 1 : 0;
+}
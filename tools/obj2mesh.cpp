@@ -0,0 +1,376 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+// OBJ to scene file converter
+//
+// Writes the binary format of meshfile.hpp, which the sample loads with
+// -scene. Every "o" or "g" statement starts a new object, polygons are
+// triangulated as fans. Vertices are shared within an object when they
+// use the same position and normal. Faces without normals get smooth
+// normals accumulated per position. Texture coordinates and materials
+// are ignored, every object gets its own light color.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../meshfile.hpp"
+
+namespace obj2mesh
+{
+  using ssao::MeshVertex;
+  using ssao::MeshObject;
+
+  struct Config {
+    float       scale;
+    std::string input;
+    std::string output;
+
+    Config() : scale(1.0f) {}
+  };
+
+  struct Vec3 {
+    float x, y, z;
+  };
+
+  class Converter {
+  public:
+    explicit Converter(const Config& cfg) : m_cfg(cfg), m_line(0) {}
+
+    bool convert()
+    {
+      FILE* file = fopen(m_cfg.input.c_str(), "rt");
+      if (!file){
+        fprintf(stderr, "could not open %s\n", m_cfg.input.c_str());
+        return false;
+      }
+
+      beginObject();
+
+      char line[4096];
+      bool ok = true;
+      while (ok && fgets(line, sizeof(line), file)){
+        m_line++;
+        ok = parseLine(line);
+      }
+      fclose(file);
+
+      if (!ok){
+        fprintf(stderr, "%s:%d: invalid statement\n", m_cfg.input.c_str(), m_line);
+        return false;
+      }
+
+      endObject();
+
+      if (m_indices.empty()){
+        fprintf(stderr, "%s: no faces\n", m_cfg.input.c_str());
+        return false;
+      }
+
+      if (!ssao::writeMeshFile(m_cfg.output.c_str(), m_vertices, m_indices, m_objects)){
+        fprintf(stderr, "could not write %s\n", m_cfg.output.c_str());
+        return false;
+      }
+
+      printf("obj2mesh: %d objects, %d vertices, %d triangles\n",
+        int(m_objects.size()), int(m_vertices.size()), int(m_indices.size() / 3));
+      return true;
+    }
+
+  private:
+    static bool isSpace(char c)
+    {
+      return c == ' ' || c == '\t';
+    }
+
+    bool parseLine(char* line)
+    {
+      while (isSpace(*line)) line++;
+
+      if (line[0] == 'v' && isSpace(line[1])){
+        Vec3 v;
+        if (!parseVec3(line + 2, v)) return false;
+        v.x *= m_cfg.scale;
+        v.y *= m_cfg.scale;
+        v.z *= m_cfg.scale;
+        m_positions.push_back(v);
+      }
+      else if (line[0] == 'v' && line[1] == 'n' && isSpace(line[2])){
+        Vec3 n;
+        if (!parseVec3(line + 3, n)) return false;
+        m_normals.push_back(n);
+      }
+      else if (line[0] == 'f' && isSpace(line[1])){
+        return parseFace(line + 2);
+      }
+      else if ((line[0] == 'o' || line[0] == 'g') && (isSpace(line[1]) || line[1] == '\n' || line[1] == '\r' || !line[1])){
+        endObject();
+        beginObject();
+      }
+      // vt, usemtl, mtllib, s, comments...
+      return true;
+    }
+
+    static bool parseVec3(const char* str, Vec3& v)
+    {
+      char* end;
+      v.x = strtof(str, &end); if (end == str) return false; str = end;
+      v.y = strtof(str, &end); if (end == str) return false; str = end;
+      v.z = strtof(str, &end); if (end == str) return false;
+      return true;
+    }
+
+    // obj indices are 1-based, negative ones are relative to the end
+    static bool resolveIndex(long idx, size_t count, int& resolved)
+    {
+      if (idx > 0 && size_t(idx) <= count)        resolved = int(idx - 1);
+      else if (idx < 0 && size_t(-idx) <= count)  resolved = int(long(count) + idx);
+      else return false;
+      return true;
+    }
+
+    bool parseFace(char* str)
+    {
+      uint32_t corners[64];
+      int numCorners = 0;
+
+      for (;;){
+        while (isSpace(*str)) str++;
+        if (!*str || *str == '\n' || *str == '\r') break;
+        if (numCorners == 64) return false;
+
+        char* end;
+        long pos = strtol(str, &end, 10);
+        if (end == str) return false;
+        str = end;
+
+        long normal = 0;
+        if (*str == '/'){
+          str++;
+          strtol(str, &end, 10);    // texcoord, optional
+          str = end;
+          if (*str == '/'){
+            str++;
+            normal = strtol(str, &end, 10);
+            if (end == str) return false;
+            str = end;
+          }
+        }
+
+        int p;
+        int n = -1;
+        if (!resolveIndex(pos, m_positions.size(), p)) return false;
+        if (normal && !resolveIndex(normal, m_normals.size(), n)) return false;
+
+        corners[numCorners++] = getVertex(p, n);
+      }
+
+      if (numCorners < 3) return numCorners == 0;
+
+      for (int i = 2; i < numCorners; i++){
+        addTriangle(corners[0], corners[i-1], corners[i]);
+      }
+      return true;
+    }
+
+    uint32_t getVertex(int position, int normal)
+    {
+      uint64_t key = (uint64_t(uint32_t(position)) << 32) | uint64_t(uint32_t(normal));
+      std::unordered_map<uint64_t,uint32_t>::iterator it = m_vertexMap.find(key);
+      if (it != m_vertexMap.end()) return it->second;
+
+      const Vec3& pos = m_positions[position];
+
+      MeshVertex vertex;
+      vertex.position[0] = pos.x;
+      vertex.position[1] = pos.y;
+      vertex.position[2] = pos.z;
+      vertex.position[3] = 1.0f;
+      if (normal >= 0){
+        const Vec3& nrm = m_normals[normal];
+        vertex.normal[0] = nrm.x;
+        vertex.normal[1] = nrm.y;
+        vertex.normal[2] = nrm.z;
+      }
+      else {
+        // accumulated from the faces, see addTriangle
+        vertex.normal[0] = vertex.normal[1] = vertex.normal[2] = 0;
+      }
+      vertex.normal[3] = normal >= 0 ? 1.0f : 0.0f;   // marks given normals until endObject
+      memcpy(vertex.color, m_color, sizeof(m_color));
+
+      uint32_t index = uint32_t(m_vertices.size());
+      m_vertices.push_back(vertex);
+      m_vertexMap[key] = index;
+
+      MeshObject& object = m_objects.back();
+      for (int c = 0; c < 3; c++){
+        object.bboxMin[c] = std::min(object.bboxMin[c], vertex.position[c]);
+        object.bboxMax[c] = std::max(object.bboxMax[c], vertex.position[c]);
+      }
+      return index;
+    }
+
+    void addTriangle(uint32_t a, uint32_t b, uint32_t c)
+    {
+      m_indices.push_back(a);
+      m_indices.push_back(b);
+      m_indices.push_back(c);
+
+      // area weighted face normal for vertices without one
+      const float* pa = m_vertices[a].position;
+      const float* pb = m_vertices[b].position;
+      const float* pc = m_vertices[c].position;
+      float e0[3] = {pb[0]-pa[0], pb[1]-pa[1], pb[2]-pa[2]};
+      float e1[3] = {pc[0]-pa[0], pc[1]-pa[1], pc[2]-pa[2]};
+      float n[3]  = {e0[1]*e1[2] - e0[2]*e1[1], e0[2]*e1[0] - e0[0]*e1[2], e0[0]*e1[1] - e0[1]*e1[0]};
+
+      uint32_t corners[3] = {a, b, c};
+      for (int i = 0; i < 3; i++){
+        MeshVertex& vertex = m_vertices[corners[i]];
+        if (vertex.normal[3] != 0) continue;
+        vertex.normal[0] += n[0];
+        vertex.normal[1] += n[1];
+        vertex.normal[2] += n[2];
+      }
+    }
+
+    void beginObject()
+    {
+      MeshObject object;
+      object.firstIndex   = uint32_t(m_indices.size());
+      object.numIndices   = 0;
+      object.firstVertex  = uint32_t(m_vertices.size());
+      object.numVertices  = 0;
+      for (int c = 0; c < 4; c++){
+        object.bboxMin[c] =  1e30f;
+        object.bboxMax[c] = -1e30f;
+      }
+      m_objects.push_back(object);
+      m_vertexMap.clear();
+
+      // light colors in the range of the generated scene
+      uint32_t hash = uint32_t(m_objects.size()) * 2654435761u;
+      for (int c = 0; c < 3; c++){
+        hash ^= hash >> 13;
+        hash *= 0x5bd1e995u;
+        hash ^= hash >> 15;
+        m_color[c] = float(hash & 0xffff) / 65535.0f * 0.25f + 0.75f;
+      }
+      m_color[3] = 1.0f;
+    }
+
+    void endObject()
+    {
+      MeshObject& object = m_objects.back();
+      object.numIndices  = uint32_t(m_indices.size()) - object.firstIndex;
+      object.numVertices = uint32_t(m_vertices.size()) - object.firstVertex;
+      object.bboxMin[3] = object.bboxMax[3] = 0;
+
+      for (size_t v = object.firstVertex; v < m_vertices.size(); v++){
+        float* n = m_vertices[v].normal;
+        float len = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if (len > 0){
+          n[0] /= len;
+          n[1] /= len;
+          n[2] /= len;
+        }
+        n[3] = 0;
+      }
+
+      // empty groups (e.g. "g" followed by "o") are dropped
+      if (!object.numIndices){
+        m_vertices.resize(object.firstVertex);
+        m_objects.pop_back();
+      }
+    }
+
+    const Config&                           m_cfg;
+    int                                     m_line;
+    std::vector<Vec3>                       m_positions;
+    std::vector<Vec3>                       m_normals;
+    std::vector<MeshVertex>                 m_vertices;
+    std::vector<uint32_t>                   m_indices;
+    std::vector<MeshObject>                 m_objects;
+    std::unordered_map<uint64_t,uint32_t>   m_vertexMap;
+    float                                   m_color[4];
+  };
+
+  static void printUsage()
+  {
+    fprintf(stderr,
+      "usage: obj2mesh [options] input.obj output.mesh\n"
+      "  -scale s                 multiplies all positions (1.0)\n");
+  }
+}
+
+using namespace obj2mesh;
+
+int main(int argc, const char** argv)
+{
+  Config cfg;
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    int left = argc - i - 1;
+
+    if (arg == "-scale" && left >= 1)   cfg.scale = float(atof(argv[++i]));
+    else if (arg[0] == '-'){
+      printUsage();
+      return 1;
+    }
+    else {
+      files.push_back(arg);
+    }
+  }
+
+  if (files.size() != 2){
+    printUsage();
+    return 1;
+  }
+  cfg.input  = files[0];
+  cfg.output = files[1];
+
+  std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+  Converter converter(cfg);
+  if (!converter.convert()){
+    return 1;
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+  printf("obj2mesh: %s in %.2f s\n", cfg.output.c_str(), seconds);
+
+  return 0;
+}
@@ -0,0 +1,93 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef TUNINGCACHE_HPP
+#define TUNINGCACHE_HPP
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+
+// Results of the auto-tuner, one line per key:
+//
+//   <key> \t <value> \n
+//
+// The key identifies GPU, driver and resolution, the value is
+// interpreted by the caller. The whole file is rewritten on every change,
+// entries of other keys are kept.
+
+class TuningCache {
+public:
+  // a missing file is not an error, it is created on the first store
+  void load(const std::string& filename)
+  {
+    m_filename = filename;
+    m_entries.clear();
+
+    FILE* file = fopen(filename.c_str(), "rt");
+    if (!file) return;
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file)){
+      std::string entry(line);
+      while (!entry.empty() && (entry[entry.size() - 1] == '\n' || entry[entry.size() - 1] == '\r')){
+        entry.erase(entry.size() - 1);
+      }
+      size_t tab = entry.find('\t');
+      if (tab == std::string::npos) continue;
+      m_entries[entry.substr(0, tab)] = entry.substr(tab + 1);
+    }
+    fclose(file);
+  }
+
+  bool find(const std::string& key, std::string& value) const
+  {
+    std::map<std::string, std::string>::const_iterator it = m_entries.find(key);
+    if (it == m_entries.end()) return false;
+    value = it->second;
+    return true;
+  }
+
+  bool store(const std::string& key, const std::string& value)
+  {
+    m_entries[key] = value;
+
+    FILE* file = fopen(m_filename.c_str(), "wt");
+    if (!file) return false;
+
+    for (std::map<std::string, std::string>::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it){
+      fprintf(file, "%s\t%s\n", it->first.c_str(), it->second.c_str());
+    }
+    fclose(file);
+    return true;
+  }
+
+private:
+  std::string                         m_filename;
+  std::map<std::string, std::string>  m_entries;
+};
+
+#endif
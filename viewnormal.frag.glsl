@@ -1,14 +1,29 @@
 #version 430
 
+#extension GL_ARB_shading_language_include : enable
+#include "common.h"
+
+// all msaa samples in one draw, gl_PrimitiveID is the sample. The depth
+// comes from its deinterleaved layers (see hbao_deinterleave_msaa.frag.glsl),
+// the normal goes to its layer of imgNormal.
+#ifndef VIEWNORMAL_MSAA_LAYERED
+#define VIEWNORMAL_MSAA_LAYERED 0
+#endif
+
 in vec2 texCoord;
 
 layout(location=0) uniform vec4 projInfo; 
 layout(location=1) uniform int  projOrtho;
 layout(location=2) uniform vec2 InvFullResolution;
 
+#if VIEWNORMAL_MSAA_LAYERED
+layout(binding=0)  uniform sampler2DArray texLinearDepth;
+layout(binding=0,rgba8) uniform writeonly image2DArray imgNormal;
+#else
 layout(binding=0)  uniform sampler2D texLinearDepth;
 
 layout(location=0,index=0) out vec4 out_Color;
+#endif
 
 //----------------------------------------------------------------------------------
 
@@ -17,9 +32,26 @@ vec3 UVToView(vec2 uv, float eye_z)
   return vec3((uv * projInfo.xy + projInfo.zw) * (projOrtho != 0 ? 1. : eye_z), eye_z);
 }
 
+#if VIEWNORMAL_MSAA_LAYERED
+float FetchDepth(vec2 UV)
+{
+  // same texel and edge clamp as the filtered fetch below
+  ivec2 Size    = ivec2(round(1.0 / InvFullResolution));
+  ivec2 Pos     = clamp(ivec2(floor(UV * vec2(Size))), ivec2(0), Size - 1);
+  ivec2 Offset  = Pos % AO_RANDOMTEX_SIZE;
+  int   Layer   = (gl_PrimitiveID * AO_RANDOMTEX_SIZE + Offset.y) * AO_RANDOMTEX_SIZE + Offset.x;
+  return texelFetch(texLinearDepth, ivec3(Pos / AO_RANDOMTEX_SIZE, Layer), 0).x;
+}
+#else
+float FetchDepth(vec2 UV)
+{
+  return textureLod(texLinearDepth,UV,0).x;
+}
+#endif
+
 vec3 FetchViewPos(vec2 UV)
 {
-  float ViewDepth = textureLod(texLinearDepth,UV,0).x;
+  float ViewDepth = FetchDepth(UV);
   return UVToView(UV, ViewDepth);
 }
 
@@ -45,7 +77,11 @@ void main() {
   vec3 P  = FetchViewPos(texCoord);
   vec3 N  = ReconstructNormal(texCoord, P);
   
+#if VIEWNORMAL_MSAA_LAYERED
+  imageStore(imgNormal, ivec3(ivec2(gl_FragCoord.xy), gl_PrimitiveID), vec4(N*0.5 + 0.5,0));
+#else
   out_Color = vec4(N*0.5 + 0.5,0);
+#endif
 }
 
 /*-----------------------------------------------------------------------
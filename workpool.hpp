@@ -0,0 +1,202 @@
+/*-----------------------------------------------------------------------
+  Copyright (c) 2014, NVIDIA. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+   * Redistributions of source code must retain the above copyright
+     notice, this list of conditions and the following disclaimer.
+   * Neither the name of its contributors may be used to endorse
+     or promote products derived from this software without specific
+     prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+  PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+  OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+-----------------------------------------------------------------------*/
+
+#ifndef WORKPOOL_HPP
+#define WORKPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small work-stealing thread pool.
+// Every worker owns a deque, tasks pushed from within a worker go to the
+// back of its own deque and are popped LIFO (keeps follow-up work on
+// the same core while the data is still in cache), idle workers steal
+// from the front of the other deques. Tasks pushed from outside
+// are distributed round-robin.
+
+class WorkPool {
+public:
+  typedef std::function<void()> Task;
+
+  explicit WorkPool(unsigned int numThreads = 0)
+    : m_pending(0)
+    , m_next(0)
+    , m_quit(false)
+  {
+    if (numThreads == 0){
+      numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    m_queues.resize(numThreads);
+    for (unsigned int i = 0; i < numThreads; i++){
+      m_queues[i] = new Queue;
+    }
+    for (unsigned int i = 0; i < numThreads; i++){
+      m_threads.push_back(std::thread(&WorkPool::run, this, int(i)));
+    }
+  }
+
+  ~WorkPool()
+  {
+    wait();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_quit = true;
+    }
+    m_cond.notify_all();
+    for (size_t i = 0; i < m_threads.size(); i++){
+      m_threads[i].join();
+    }
+    for (size_t i = 0; i < m_queues.size(); i++){
+      delete m_queues[i];
+    }
+  }
+
+  void push(Task task)
+  {
+    int self = getWorkerIndex();
+    size_t idx = self >= 0 ? size_t(self) : (m_next++ % m_queues.size());
+
+    m_pending++;
+    {
+      std::lock_guard<std::mutex> lock(m_queues[idx]->mutex);
+      m_queues[idx]->tasks.push_back(std::move(task));
+    }
+    {
+      // pairs with the predicate check in run, avoids lost wakeups
+      std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_cond.notify_one();
+  }
+
+  // blocks until every pushed task (including tasks pushed by tasks) is done
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idleCond.wait(lock, [this]{ return m_pending == 0; });
+  }
+
+  unsigned int getNumThreads() const
+  {
+    return (unsigned int)m_threads.size();
+  }
+
+  // index of the calling worker of this pool, -1 for any other thread
+  int getWorkerIndex() const
+  {
+    return s_current().pool == this ? s_current().index : -1;
+  }
+
+private:
+  struct Queue {
+    std::mutex        mutex;
+    std::deque<Task>  tasks;
+  };
+
+  struct Current {
+    const WorkPool* pool;
+    int             index;
+  };
+
+  static Current& s_current()
+  {
+    static thread_local Current current = {NULL, -1};
+    return current;
+  }
+
+  bool pop(int idx, Task& task)
+  {
+    {
+      Queue& own = *m_queues[idx];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()){
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        return true;
+      }
+    }
+
+    size_t num = m_queues.size();
+    for (size_t i = 1; i < num; i++){
+      Queue& other = *m_queues[(idx + i) % num];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      if (!other.tasks.empty()){
+        task = std::move(other.tasks.front());
+        other.tasks.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  bool hasWork()
+  {
+    for (size_t i = 0; i < m_queues.size(); i++){
+      std::lock_guard<std::mutex> lock(m_queues[i]->mutex);
+      if (!m_queues[i]->tasks.empty()) return true;
+    }
+    return false;
+  }
+
+  void run(int idx)
+  {
+    s_current().pool  = this;
+    s_current().index = idx;
+
+    for (;;){
+      Task task;
+      if (pop(idx, task)){
+        task();
+        if (--m_pending == 0){
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_idleCond.notify_all();
+        }
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_cond.wait(lock, [this]{ return m_quit || hasWork(); });
+      if (m_quit) return;
+    }
+  }
+
+  std::vector<std::thread>  m_threads;
+  std::vector<Queue*>       m_queues;
+  std::mutex                m_mutex;
+  std::condition_variable   m_cond;
+  std::condition_variable   m_idleCond;
+  std::atomic<int>          m_pending;
+  std::atomic<unsigned int> m_next;
+  bool                      m_quit;
+};
+
+#endif